@@ -0,0 +1,252 @@
+// ----------------------------------------------------------------------------------------------------
+//
+// Micro-benchmark of the depth buffer writes. Feeds the same stream of pixels (generated from random
+// screen-space triangles, in the scanline order of the rasterizer) to the per-pixel render result
+// that the depth sensor used to have and to the span-based DepthBufferRenderResult, checks that both
+// produce identical images and writes the timings as JSON to stdout. Also renders the spans split over
+// several buffers with labels (like the render tasks of the render service do), merges them and checks
+// that the result is identical as well.
+//
+// Usage: depth_buffer_bench [-w width] [-h height] [-t triangles] [-r repetitions] [-b buffers]
+//
+// ----------------------------------------------------------------------------------------------------
+
+#include "fast_simulator2/depth_buffer.h"
+
+#include <opencv2/core/core.hpp>
+
+#include <tue/profiling/timer.h>
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+// ----------------------------------------------------------------------------------------------------
+
+// Previous implementation of the depth sensor render result
+class PixelRenderResult : public geo::RenderResult
+{
+
+public:
+
+    PixelRenderResult(cv::Mat& z_buffer, int width, int height)
+                : geo::RenderResult(width, height), z_buffer_(z_buffer)
+    {
+    }
+
+    void renderPixel(int x, int y, float depth, int i_triangle)
+    {
+        float old_depth = z_buffer_.at<float>(y, x);
+        if (old_depth == 0 || depth < old_depth)
+        {
+            z_buffer_.at<float>(y, x) = depth;
+        }
+    }
+
+protected:
+
+    cv::Mat& z_buffer_;
+
+};
+
+// ----------------------------------------------------------------------------------------------------
+
+struct Span
+{
+    int x, y, n;
+    float depth, slope;
+};
+
+// ----------------------------------------------------------------------------------------------------
+
+void createSpans(int width, int height, int num_triangles, std::vector<Span>& spans)
+{
+    for(int i = 0; i < num_triangles; ++i)
+    {
+        // Triangle with a horizontal base, covering at most a quarter of the image
+        int x0 = rand() % width;
+        int y0 = rand() % height;
+        int w = 1 + rand() % (width / 2);
+        int h = 1 + rand() % (height / 2);
+        float depth = 0.5f + 5.0f * rand() / RAND_MAX;
+        float slope = 0.001f * (rand() % 21 - 10);
+
+        for(int y = y0; y < std::min(y0 + h, height); ++y)
+        {
+            Span s;
+            s.n = (w * (y - y0 + 1)) / h;
+            s.x = std::max(0, x0 - s.n / 2);
+            s.n = std::min(s.n, width - s.x);
+            s.y = y;
+            s.depth = depth + 0.01f * (y - y0);
+            s.slope = slope;
+            if (s.n > 0)
+                spans.push_back(s);
+        }
+    }
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+// Reports the pixels one by one, like the rasterizer does
+void render(const std::vector<Span>& spans, geo::RenderResult& res)
+{
+    for(std::vector<Span>::const_iterator it = spans.begin(); it != spans.end(); ++it)
+    {
+        for(int i = 0; i < it->n; ++i)
+            res.renderPixel(it->x + i, it->y, it->depth + it->slope * i, 0);
+    }
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+int main(int argc, char **argv)
+{
+    int width = 640;
+    int height = 480;
+    int num_triangles = 2000;
+    int num_repetitions = 100;
+    int num_buffers = 4;
+
+    for(int i = 1; i + 1 < argc; i += 2)
+    {
+        std::string arg = argv[i];
+        if (arg == "-w")
+            width = atoi(argv[i + 1]);
+        else if (arg == "-h")
+            height = atoi(argv[i + 1]);
+        else if (arg == "-t")
+            num_triangles = atoi(argv[i + 1]);
+        else if (arg == "-r")
+            num_repetitions = atoi(argv[i + 1]);
+        else if (arg == "-b")
+            num_buffers = std::max(1, atoi(argv[i + 1]));
+        else
+        {
+            std::cerr << "Usage: depth_buffer_bench [-w width] [-h height] [-t triangles] [-r repetitions] [-b buffers]" << std::endl;
+            return 1;
+        }
+    }
+
+    std::vector<Span> spans;
+    createSpans(width, height, num_triangles, spans);
+
+    unsigned long num_pixels = 0;
+    for(std::vector<Span>::const_iterator it = spans.begin(); it != spans.end(); ++it)
+        num_pixels += it->n;
+
+    cv::Mat image_pixel(height, width, CV_32FC1, 0.0);
+    cv::Mat image_span(height, width, CV_32FC1, 0.0);
+
+    // - - - - - - - - - - - - - - - per-pixel - - - - - - - - - - - - - - -
+
+    tue::Timer timer_pixel;
+    timer_pixel.start();
+    for(int i = 0; i < num_repetitions; ++i)
+    {
+        image_pixel.setTo(0);
+        PixelRenderResult res(image_pixel, width, height);
+        render(spans, res);
+    }
+    timer_pixel.stop();
+
+    // - - - - - - - - - - - - - - - spans - - - - - - - - - - - - - - -
+
+    tue::Timer timer_span;
+    timer_span.start();
+    for(int i = 0; i < num_repetitions; ++i)
+    {
+        image_span.setTo(0);
+        sim::DepthBufferRenderResult res(sim::DepthBuffer(image_span.ptr<float>(0), width, height,
+                                                          image_span.step / sizeof(float)));
+        render(spans, res);
+        res.flush();
+    }
+    timer_span.stop();
+
+    // - - - - - - - - - - - - - - - split and merged - - - - - - - - - - - - - - -
+
+    // Each buffer renders a contiguous part of the spans, labeled with the index of the span. The
+    // reference renders all spans into one buffer.
+    cv::Mat image_ref(height, width, CV_32FC1, 0.0);
+    cv::Mat labels_ref(height, width, CV_32SC1, cv::Scalar(0));
+    {
+        sim::DepthBufferRenderResult res(sim::DepthBuffer(image_ref.ptr<float>(0), labels_ref.ptr<int>(0), width,
+                                                          height, image_ref.step / sizeof(float)));
+        for(unsigned int i = 0; i < spans.size(); ++i)
+        {
+            res.setLabel(i + 1);
+            std::vector<Span> span(1, spans[i]);
+            render(span, res);
+        }
+    }
+
+    std::vector<cv::Mat> images_split(num_buffers), labels_split(num_buffers);
+    for(int b = 0; b < num_buffers; ++b)
+    {
+        images_split[b] = cv::Mat(height, width, CV_32FC1, 0.0);
+        labels_split[b] = cv::Mat(height, width, CV_32SC1, cv::Scalar(0));
+
+        sim::DepthBufferRenderResult res(sim::DepthBuffer(images_split[b].ptr<float>(0), labels_split[b].ptr<int>(0),
+                                                          width, height, width));
+        for(unsigned int i = b * spans.size() / num_buffers; i < (b + 1) * spans.size() / num_buffers; ++i)
+        {
+            res.setLabel(i + 1);
+            std::vector<Span> span(1, spans[i]);
+            render(span, res);
+        }
+    }
+
+    cv::Mat image_merged(height, width, CV_32FC1), labels_merged(height, width, CV_32SC1);
+
+    tue::Timer timer_merge;
+    timer_merge.start();
+    for(int i = 0; i < num_repetitions; ++i)
+    {
+        images_split[0].copyTo(image_merged);
+        labels_split[0].copyTo(labels_merged);
+
+        sim::DepthBuffer merged(image_merged.ptr<float>(0), labels_merged.ptr<int>(0), width, height, width);
+        for(int b = 1; b < num_buffers; ++b)
+            merged.merge(sim::DepthBuffer(images_split[b].ptr<float>(0), labels_split[b].ptr<int>(0), width, height,
+                                          width), 0, height);
+    }
+    timer_merge.stop();
+
+    // - - - - - - - - - - - - - - - output - - - - - - - - - - - - - - -
+
+    bool identical = true;
+    for(int y = 0; y < height; ++y)
+    {
+        if (std::memcmp(image_pixel.ptr<float>(y), image_span.ptr<float>(y), width * sizeof(float)) != 0)
+            identical = false;
+    }
+
+    // Labels must match as well: for equal depths the earliest span wins in both, since the buffers are
+    // merged in span order and a merge only takes strictly closer depths
+    bool merge_identical = true;
+    for(int y = 0; y < height; ++y)
+    {
+        if (std::memcmp(image_ref.ptr<float>(y), image_merged.ptr<float>(y), width * sizeof(float)) != 0
+                || std::memcmp(labels_ref.ptr<int>(y), labels_merged.ptr<int>(y), width * sizeof(int)) != 0)
+            merge_identical = false;
+    }
+
+    double t_pixel = timer_pixel.getElapsedTimeInSec() / num_repetitions;
+    double t_span = timer_span.getElapsedTimeInSec() / num_repetitions;
+
+    std::cout << "{" << std::endl;
+    std::cout << "  \"width\": " << width << ", \"height\": " << height << ", \"triangles\": " << num_triangles
+              << ", \"pixels_per_frame\": " << num_pixels << "," << std::endl;
+    std::cout << "  \"per_pixel_ms\": " << 1e3 * t_pixel << "," << std::endl;
+    std::cout << "  \"span_ms\": " << 1e3 * t_span << "," << std::endl;
+    std::cout << "  \"speedup\": " << (t_span > 0 ? t_pixel / t_span : 0) << "," << std::endl;
+    std::cout << "  \"identical\": " << (identical ? "true" : "false") << "," << std::endl;
+    std::cout << "  \"merge_buffers\": " << num_buffers << "," << std::endl;
+    std::cout << "  \"merge_ms\": " << 1e3 * timer_merge.getElapsedTimeInSec() / num_repetitions << "," << std::endl;
+    std::cout << "  \"merge_identical\": " << (merge_identical ? "true" : "false") << std::endl;
+    std::cout << "}" << std::endl;
+
+    return identical && merge_identical ? 0 : 1;
+}
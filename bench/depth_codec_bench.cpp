@@ -0,0 +1,199 @@
+// ----------------------------------------------------------------------------------------------------
+//
+// Micro-benchmark of depth image compression. Renders a synthetic room (floor, walls and randomly
+// placed boxes) with the depth camera, and compares size and encode / decode time of the raw image,
+// the lossless codec of the simulator (depth_codec.h) and 16-bit (millimeter) PNG, which is what the
+// rgbd topic uses by default. Checks that the simulator codec round-trips exactly and writes the
+// results as JSON to stdout.
+//
+// Usage: depth_codec_bench [-w width] [-h height] [-b boxes] [-r repetitions]
+//
+// ----------------------------------------------------------------------------------------------------
+
+#include "fast_simulator2/depth_codec.h"
+#include "fast_simulator2/depth_buffer.h"
+
+#include <geolib/Box.h>
+#include <geolib/sensors/DepthCamera.h>
+
+#include <opencv2/core/core.hpp>
+#include <opencv2/highgui/highgui.hpp>
+
+#include <tue/profiling/timer.h>
+
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+// ----------------------------------------------------------------------------------------------------
+
+double randomDouble(double min, double max)
+{
+    return min + (max - min) * rand() / RAND_MAX;
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+void renderBox(const geo::DepthCamera& cam, const geo::Vector3& min, const geo::Vector3& max, cv::Mat& image)
+{
+    geo::Box box(min, max);
+
+    geo::RenderOptions opt;
+    opt.setMesh(box.getMesh(), geo::Pose3D::identity());
+
+    sim::DepthBufferRenderResult res(sim::DepthBuffer(image.ptr<float>(0), image.cols, image.rows,
+                                                      image.step / sizeof(float)));
+    cam.render(opt, res);
+    res.flush();
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+// Renders a room in front of the camera (which looks along -z, with y up)
+void renderRoom(const geo::DepthCamera& cam, int num_boxes, cv::Mat& image)
+{
+    image.setTo(0);
+
+    renderBox(cam, geo::Vector3(-3, -1.2, -6), geo::Vector3(3, -1, 0), image);  // floor
+    renderBox(cam, geo::Vector3(-3, -1, -6), geo::Vector3(3, 2, -5.8), image);  // back wall
+    renderBox(cam, geo::Vector3(-3, -1, -6), geo::Vector3(-2.8, 2, 0), image);  // left wall
+
+    for(int i = 0; i < num_boxes; ++i)
+    {
+        geo::Vector3 min(randomDouble(-2.5, 2.5), -1, randomDouble(-5.5, -1));
+        geo::Vector3 size(randomDouble(0.1, 0.8), randomDouble(0.1, 1.5), randomDouble(0.1, 0.8));
+        renderBox(cam, min, min + size, image);
+    }
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+int main(int argc, char **argv)
+{
+    int width = 640;
+    int height = 480;
+    int num_boxes = 20;
+    int num_repetitions = 100;
+
+    for(int i = 1; i + 1 < argc; i += 2)
+    {
+        std::string arg = argv[i];
+        if (arg == "-w")
+            width = atoi(argv[i + 1]);
+        else if (arg == "-h")
+            height = atoi(argv[i + 1]);
+        else if (arg == "-b")
+            num_boxes = atoi(argv[i + 1]);
+        else if (arg == "-r")
+            num_repetitions = atoi(argv[i + 1]);
+        else
+        {
+            std::cerr << "Usage: depth_codec_bench [-w width] [-h height] [-b boxes] [-r repetitions]" << std::endl;
+            return 1;
+        }
+    }
+
+    // Same intrinsics as a Kinect at 640x480
+    geo::DepthCamera cam;
+    cam.setFocalLengths(0.87 * width, 0.87 * width);
+    cam.setOpticalCenter(width / 2 + 0.5, height / 2 + 0.5);
+    cam.setOpticalTranslation(0, 0);
+
+    cv::Mat image(height, width, CV_32FC1, 0.0);
+    renderRoom(cam, num_boxes, image);
+
+    std::size_t raw_size = width * height * sizeof(float);
+
+    // The timer does not accumulate, so the time of each call is summed
+    tue::Timer timer;
+
+    // - - - - - - - - - - - - - - - raw (copy) - - - - - - - - - - - - - - -
+
+    std::vector<unsigned char> raw(raw_size);
+    cv::Mat raw_decoded(height, width, CV_32FC1);
+
+    double t_raw_enc = 0, t_raw_dec = 0;
+    for(int i = 0; i < num_repetitions; ++i)
+    {
+        timer.start();
+        std::memcpy(&raw[0], image.ptr<float>(0), raw_size);
+        timer.stop();
+        t_raw_enc += timer.getElapsedTimeInSec();
+
+        timer.start();
+        std::memcpy(raw_decoded.ptr<float>(0), &raw[0], raw_size);
+        timer.stop();
+        t_raw_dec += timer.getElapsedTimeInSec();
+    }
+
+    // - - - - - - - - - - - - - - - simulator codec - - - - - - - - - - - - - - -
+
+    std::vector<unsigned char> encoded;
+    std::vector<float> decoded;
+    int decoded_width = 0, decoded_height = 0;
+    bool ok = true;
+
+    double t_sim_enc = 0, t_sim_dec = 0;
+    for(int i = 0; i < num_repetitions; ++i)
+    {
+        timer.start();
+        sim::encodeDepth(image.ptr<float>(0), width, height, image.step / sizeof(float), encoded);
+        timer.stop();
+        t_sim_enc += timer.getElapsedTimeInSec();
+
+        timer.start();
+        ok = sim::decodeDepth(&encoded[0], encoded.size(), decoded_width, decoded_height, decoded) && ok;
+        timer.stop();
+        t_sim_dec += timer.getElapsedTimeInSec();
+    }
+
+    bool identical = ok && decoded_width == width && decoded_height == height
+            && std::memcmp(&decoded[0], image.ptr<float>(0), raw_size) == 0;
+
+    // - - - - - - - - - - - - - - - PNG (16-bit millimeters) - - - - - - - - - - - - - - -
+
+    std::vector<int> png_params;
+    png_params.push_back(CV_IMWRITE_PNG_COMPRESSION);
+    png_params.push_back(1);
+
+    cv::Mat image_mm;
+    std::vector<unsigned char> png;
+    cv::Mat png_decoded;
+
+    double t_png_enc = 0, t_png_dec = 0;
+    for(int i = 0; i < num_repetitions; ++i)
+    {
+        timer.start();
+        image.convertTo(image_mm, CV_16UC1, 1000);
+        cv::imencode(".png", image_mm, png, png_params);
+        timer.stop();
+        t_png_enc += timer.getElapsedTimeInSec();
+
+        timer.start();
+        png_decoded = cv::imdecode(png, CV_LOAD_IMAGE_UNCHANGED);
+        timer.stop();
+        t_png_dec += timer.getElapsedTimeInSec();
+    }
+
+    // - - - - - - - - - - - - - - - output - - - - - - - - - - - - - - -
+
+    double n = num_repetitions;
+
+    std::cout << "{" << std::endl;
+    std::cout << "  \"width\": " << width << ", \"height\": " << height << ", \"boxes\": " << num_boxes << "," << std::endl;
+    std::cout << "  \"raw\": { \"bytes\": " << raw_size
+              << ", \"encode_ms\": " << 1e3 * t_raw_enc / n
+              << ", \"decode_ms\": " << 1e3 * t_raw_dec / n << " }," << std::endl;
+    std::cout << "  \"sim_codec\": { \"bytes\": " << encoded.size()
+              << ", \"ratio\": " << (double)encoded.size() / raw_size
+              << ", \"encode_ms\": " << 1e3 * t_sim_enc / n
+              << ", \"decode_ms\": " << 1e3 * t_sim_dec / n
+              << ", \"lossless\": " << (identical ? "true" : "false") << " }," << std::endl;
+    std::cout << "  \"png_mm\": { \"bytes\": " << png.size()
+              << ", \"ratio\": " << (double)png.size() / raw_size
+              << ", \"encode_ms\": " << 1e3 * t_png_enc / n
+              << ", \"decode_ms\": " << 1e3 * t_png_dec / n << " }" << std::endl;
+    std::cout << "}" << std::endl;
+
+    return identical ? 0 : 1;
+}
@@ -0,0 +1,110 @@
+// ----------------------------------------------------------------------------------------------------
+//
+// Micro-benchmark of the laser beam caster. Casts the beams of a laser against random line segments
+// (as produced by slicing the world with the scan plane), once on the calling thread and once split
+// over a thread pool, checks that both produce identical ranges and writes the timings as JSON to
+// stdout.
+//
+// Usage: laser_scan_bench [-b beams] [-s segments] [-t threads] [-r repetitions]
+//
+// ----------------------------------------------------------------------------------------------------
+
+#include "fast_simulator2/laser_scan.h"
+#include "fast_simulator2/thread_pool.h"
+
+#include <tue/profiling/timer.h>
+
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+// ----------------------------------------------------------------------------------------------------
+
+float randomFloat(float min, float max)
+{
+    return min + (max - min) * rand() / RAND_MAX;
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+int main(int argc, char **argv)
+{
+    int num_beams = 1080;
+    int num_segments = 2000;
+    int num_threads = 0;
+    int num_repetitions = 1000;
+
+    for(int i = 1; i + 1 < argc; i += 2)
+    {
+        std::string arg = argv[i];
+        if (arg == "-b")
+            num_beams = atoi(argv[i + 1]);
+        else if (arg == "-s")
+            num_segments = atoi(argv[i + 1]);
+        else if (arg == "-t")
+            num_threads = atoi(argv[i + 1]);
+        else if (arg == "-r")
+            num_repetitions = atoi(argv[i + 1]);
+        else
+        {
+            std::cerr << "Usage: laser_scan_bench [-b beams] [-s segments] [-t threads] [-r repetitions]" << std::endl;
+            return 1;
+        }
+    }
+
+    // Walls and furniture within 10 m of the laser
+    std::vector<sim::LineSegment> segments;
+    for(int i = 0; i < num_segments; ++i)
+    {
+        float x = randomFloat(-10, 10);
+        float y = randomFloat(-10, 10);
+        float a = randomFloat(0, 2 * M_PI);
+        float l = randomFloat(0.05, 2);
+        segments.push_back(sim::LineSegment(x, y, x + l * std::cos(a), y + l * std::sin(a)));
+    }
+
+    // Field of view of 270 degrees
+    double angle_min = -2.35, angle_max = 2.35;
+
+    sim::BeamCaster caster;
+    caster.configure(angle_min, (angle_max - angle_min) / (num_beams - 1), num_beams, 0.01, 30);
+
+    std::vector<float> ranges_serial(num_beams), ranges_parallel(num_beams);
+
+    sim::ThreadPool pool(num_threads);
+
+    // - - - - - - - - - - - - - - - serial - - - - - - - - - - - - - - -
+
+    tue::Timer timer_serial;
+    timer_serial.start();
+    for(int i = 0; i < num_repetitions; ++i)
+        caster.cast(segments, &ranges_serial[0]);
+    timer_serial.stop();
+
+    // - - - - - - - - - - - - - - - parallel - - - - - - - - - - - - - - -
+
+    tue::Timer timer_parallel;
+    timer_parallel.start();
+    for(int i = 0; i < num_repetitions; ++i)
+        caster.cast(segments, &ranges_parallel[0], &pool);
+    timer_parallel.stop();
+
+    // - - - - - - - - - - - - - - - output - - - - - - - - - - - - - - -
+
+    bool identical = std::memcmp(&ranges_serial[0], &ranges_parallel[0], num_beams * sizeof(float)) == 0;
+
+    double t_serial = timer_serial.getElapsedTimeInSec() / num_repetitions;
+    double t_parallel = timer_parallel.getElapsedTimeInSec() / num_repetitions;
+
+    std::cout << "{" << std::endl;
+    std::cout << "  \"beams\": " << num_beams << ", \"segments\": " << num_segments << ", \"threads\": "
+              << pool.numThreads() << "," << std::endl;
+    std::cout << "  \"serial_ms\": " << 1e3 * t_serial << "," << std::endl;
+    std::cout << "  \"parallel_ms\": " << 1e3 * t_parallel << "," << std::endl;
+    std::cout << "  \"speedup\": " << (t_parallel > 0 ? t_serial / t_parallel : 0) << "," << std::endl;
+    std::cout << "  \"identical\": " << (identical ? "true" : "false") << std::endl;
+    std::cout << "}" << std::endl;
+
+    return identical ? 0 : 1;
+}
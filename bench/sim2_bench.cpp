@@ -0,0 +1,230 @@
+// ----------------------------------------------------------------------------------------------------
+//
+// Headless benchmark of the simulation core. Builds synthetic worlds with N entities, M plugins and
+// K update requests per step, and measures Simulator::configure, Simulator::step and World snapshot
+// copies. Does not need a ROS master. Results are written as JSON to stdout.
+//
+// Usage: sim2_bench [-n entities,...] [-m plugins] [-k requests] [-s steps]
+//
+// ----------------------------------------------------------------------------------------------------
+
+#include "fast_simulator2/simulator.h"
+#include "fast_simulator2/plugin.h"
+#include "fast_simulator2/world.h"
+
+#include <ed/update_request.h>
+#include <ed/relations/transform_cache.h>
+
+#include <tue/config/configuration.h>
+#include <tue/profiling/timer.h>
+
+#include <cstdlib>
+#include <iostream>
+#include <sstream>
+
+// ----------------------------------------------------------------------------------------------------
+
+// Looks up the pose of its object every cycle and, if 'write' is set, moves the object
+class BenchPlugin : public sim::Plugin
+{
+
+public:
+
+    BenchPlugin() : write_(0) {}
+
+    void configure(tue::Configuration config, const sim::LUId& obj_id)
+    {
+        config.value("write", write_);
+    }
+
+    void process(const sim::World& world, const sim::LUId& obj_id, double time, double dt, ed::UpdateRequest& req)
+    {
+        geo::Pose3D pose;
+        if (!world.calculateTransform("world", obj_id.id, time, pose) || !write_)
+            return;
+
+        pose.t.x += dt;
+
+        boost::shared_ptr<ed::TransformCache> r(new ed::TransformCache());
+        r->insert(ed::Time(time), pose);
+        req.setRelation("world", obj_id.id, r);
+    }
+
+private:
+
+    int write_;
+
+};
+
+// ----------------------------------------------------------------------------------------------------
+
+std::string entityId(int i)
+{
+    std::stringstream ss;
+    ss << "entity-" << i;
+    return ss.str();
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+void createWorldConfig(int num_entities, tue::Configuration& config)
+{
+    config.setValue("lockstep", 1);
+
+    config.writeArray("objects");
+    for(int i = 0; i < num_entities; ++i)
+    {
+        config.addArrayItem();
+        config.setValue("id", entityId(i));
+        config.setValue("type", "bench_object");
+
+        config.writeGroup("pose");
+        config.setValue("x", (double)(i % 100));
+        config.setValue("y", (double)(i / 100));
+        config.setValue("z", 0.0);
+        config.endGroup();
+
+        config.endArrayItem();
+    }
+    config.endArray();
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+void printTime(const std::string& key, double total, int count, bool last = false)
+{
+    std::cout << "      \"" << key << "\": {\"total_s\": " << total << ", \"count\": " << count
+              << ", \"mean_us\": " << (count > 0 ? 1e6 * total / count : 0)
+              << ", \"per_s\": " << (total > 0 ? count / total : 0) << "}" << (last ? "" : ",") << std::endl;
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+void runBenchmark(int num_entities, int num_plugins, int num_requests, int num_steps, bool last)
+{
+    double dt = 0.01;
+
+    sim::Simulator simulator;
+
+    // - - - - - - - - - - - - - - - configure - - - - - - - - - - - - - - -
+
+    tue::Configuration config;
+    createWorldConfig(num_entities, config);
+
+    tue::Timer timer_configure;
+    timer_configure.start();
+    simulator.configure(config);
+    timer_configure.stop();
+
+    // Attach the plugins to the first M entities. The first K of them write every step.
+    for(int i = 0; i < num_plugins && i < num_entities; ++i)
+    {
+        tue::Configuration plugin_cfg;
+        plugin_cfg.setValue("_object", entityId(i));
+        plugin_cfg.setValue("_frequency", 1.0 / dt);
+        plugin_cfg.setValue("write", i < num_requests ? 1 : 0);
+
+        std::string error;
+        simulator.addPlugin(entityId(i) + "-bench", sim::PluginPtr(new BenchPlugin), plugin_cfg, error);
+        if (!error.empty())
+            std::cerr << error << std::endl;
+    }
+
+    // - - - - - - - - - - - - - - - step - - - - - - - - - - - - - - -
+
+    tue::Timer timer_step;
+    timer_step.start();
+    for(int i = 0; i < num_steps; ++i)
+        simulator.step(dt);
+    timer_step.stop();
+
+    // - - - - - - - - - - - - - - - snapshot copy - - - - - - - - - - - - - - -
+
+    sim::WorldConstPtr world = simulator.world();
+
+    tue::Timer timer_copy;
+    timer_copy.start();
+    for(int i = 0; i < num_steps; ++i)
+    {
+        sim::WorldPtr world_copy(new sim::World(*world));
+    }
+    timer_copy.stop();
+
+    // Copy plus K changes, which is what one step does with the world
+    ed::UpdateRequest req;
+    for(int i = 0; i < num_requests && i < num_entities; ++i)
+    {
+        boost::shared_ptr<ed::TransformCache> r(new ed::TransformCache());
+        r->insert(ed::Time(0), geo::Pose3D::identity());
+        req.setRelation("world", entityId(i), r);
+    }
+
+    tue::Timer timer_update;
+    timer_update.start();
+    for(int i = 0; i < num_steps; ++i)
+    {
+        sim::WorldPtr world_copy(new sim::World(*world));
+        world_copy->update(req);
+    }
+    timer_update.stop();
+
+    // - - - - - - - - - - - - - - - output - - - - - - - - - - - - - - -
+
+    std::cout << "  {" << std::endl;
+    std::cout << "    \"entities\": " << num_entities << ", \"plugins\": " << num_plugins
+              << ", \"requests_per_step\": " << num_requests << "," << std::endl;
+    std::cout << "    \"results\": {" << std::endl;
+    printTime("configure", timer_configure.getElapsedTimeInSec(), 1);
+    printTime("step", timer_step.getElapsedTimeInSec(), num_steps);
+    printTime("snapshot_copy", timer_copy.getElapsedTimeInSec(), num_steps);
+    printTime("snapshot_copy_update", timer_update.getElapsedTimeInSec(), num_steps, true);
+    std::cout << "    }" << std::endl;
+    std::cout << "  }" << (last ? "" : ",") << std::endl;
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+int main(int argc, char **argv)
+{
+    std::vector<int> entity_counts;
+    int num_plugins = 10;
+    int num_requests = 5;
+    int num_steps = 1000;
+
+    for(int i = 1; i + 1 < argc; i += 2)
+    {
+        std::string arg = argv[i];
+        if (arg == "-n")
+        {
+            std::stringstream ss(argv[i + 1]);
+            std::string item;
+            while (std::getline(ss, item, ','))
+                entity_counts.push_back(atoi(item.c_str()));
+        }
+        else if (arg == "-m")
+            num_plugins = atoi(argv[i + 1]);
+        else if (arg == "-k")
+            num_requests = atoi(argv[i + 1]);
+        else if (arg == "-s")
+            num_steps = atoi(argv[i + 1]);
+        else
+        {
+            std::cerr << "Usage: sim2_bench [-n entities,...] [-m plugins] [-k requests] [-s steps]" << std::endl;
+            return 1;
+        }
+    }
+
+    if (entity_counts.empty())
+    {
+        entity_counts.push_back(100);
+        entity_counts.push_back(1000);
+        entity_counts.push_back(10000);
+    }
+
+    std::cout << "[" << std::endl;
+    for(unsigned int i = 0; i < entity_counts.size(); ++i)
+        runBenchmark(entity_counts[i], num_plugins, num_requests, num_steps, i + 1 == entity_counts.size());
+    std::cout << "]" << std::endl;
+
+    return 0;
+}
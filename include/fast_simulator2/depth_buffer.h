@@ -0,0 +1,126 @@
+#ifndef FAST_SIMULATOR2_DEPTH_BUFFER_H_
+#define FAST_SIMULATOR2_DEPTH_BUFFER_H_
+
+#include <geolib/sensors/DepthCamera.h>
+
+namespace sim
+{
+
+// ----------------------------------------------------------------------------------------------------
+//
+// View on a raw float z-buffer (not owned). A depth of 0 means 'no depth'. All writes are depth
+// tested: a pixel takes a new (non-zero) depth if it is empty or if the new depth is smaller. Rows are
+// processed with SSE/AVX where available, with a scalar fallback.
+//
+// Optionally, the buffer has a label (e.g. instance ID) per pixel, which is written together with
+// the depth: a pixel that takes a new depth also takes its label.
+//
+// ----------------------------------------------------------------------------------------------------
+
+class DepthBuffer
+{
+
+public:
+
+    DepthBuffer() : data_(0), labels_(0), width_(0), height_(0), stride_(0) {}
+
+    // 'stride' is the distance between the starts of two rows, in floats
+    DepthBuffer(float* data, int width, int height, int stride) : data_(data), labels_(0), width_(width),
+        height_(height), stride_(stride) {}
+
+    // With a label buffer, which has the same layout as the depth buffer
+    DepthBuffer(float* data, int* labels, int width, int height, int stride) : data_(data), labels_(labels),
+        width_(width), height_(height), stride_(stride) {}
+
+    int width() const { return width_; }
+
+    int height() const { return height_; }
+
+    float* row(int y) { return data_ + y * stride_; }
+
+    const float* row(int y) const { return data_ + y * stride_; }
+
+    bool hasLabels() const { return labels_ != 0; }
+
+    int* labelRow(int y) { return labels_ + y * stride_; }
+
+    const int* labelRow(int y) const { return labels_ + y * stride_; }
+
+    // Depth-tests the n depths against the pixels (x, y) .. (x + n - 1, y). The pixels that take the new
+    // depth get the label (if the buffer has labels).
+    void writeSpan(int x, int y, const float* depths, int n, int label = 0);
+
+    // Depth-tests all pixels of 'other' (same size) in the rows [row_begin, row_end). Empty pixels of
+    // 'other' are skipped. Labels are taken from 'other' if both buffers have them.
+    void merge(const DepthBuffer& other, int row_begin, int row_end);
+
+private:
+
+    float* data_;
+
+    int* labels_;
+
+    int width_, height_, stride_;
+
+};
+
+// ----------------------------------------------------------------------------------------------------
+//
+// geolib render result that writes into a DepthBuffer. The rasterizer reports pixels one by one; runs
+// of consecutive pixels on the same row are collected into a span that is depth-tested in one go.
+// flush() must be called after rendering to write the last span. Does not allocate.
+//
+// ----------------------------------------------------------------------------------------------------
+
+class DepthBufferRenderResult : public geo::RenderResult
+{
+
+public:
+
+    DepthBufferRenderResult(const DepthBuffer& buffer);
+
+    ~DepthBufferRenderResult() { flush(); }
+
+    // Label of the pixels rendered from now on (e.g. the instance ID of the entity that is rendered)
+    void setLabel(int label)
+    {
+        flush();
+        label_ = label;
+    }
+
+    void renderPixel(int x, int y, float depth, int /*i_triangle*/)
+    {
+        if (y != span_y_ || x != span_x_ + span_size_ || span_size_ == MAX_SPAN_SIZE)
+        {
+            flush();
+            span_x_ = x;
+            span_y_ = y;
+        }
+
+        span_[span_size_++] = depth;
+    }
+
+    void flush()
+    {
+        if (span_size_ > 0)
+            buffer_.writeSpan(span_x_, span_y_, span_, span_size_, label_);
+        span_size_ = 0;
+    }
+
+private:
+
+    DepthBuffer buffer_;
+
+    static const int MAX_SPAN_SIZE = 256;
+
+    // Depths of the current span, which starts at (span_x_, span_y_). Longer runs are split up.
+    float span_[MAX_SPAN_SIZE];
+    int span_x_, span_y_, span_size_;
+
+    int label_;
+
+};
+
+} // end namespace sim
+
+#endif
@@ -0,0 +1,37 @@
+#ifndef FAST_SIMULATOR2_DEPTH_CODEC_H_
+#define FAST_SIMULATOR2_DEPTH_CODEC_H_
+
+#include <cstddef>
+#include <vector>
+
+namespace sim
+{
+
+// ----------------------------------------------------------------------------------------------------
+//
+// Fast lossless codec for float depth images (0 = no depth), without external dependencies.
+//
+// Pixels are predicted from their left neighbours on the same row, using the IEEE bit patterns as
+// integers (which are monotonic for positive floats): linear extrapolation on surfaces, the previous
+// value after an edge. The residuals are zigzag-encoded as varints, and runs of zero residuals
+// (background, constant depth, planes facing the camera) are run-length encoded. Rendered images
+// typically compress to 10-30% of their raw size at several hundred MB/s.
+//
+// Format: varint width, varint height, followed by the tokens of all rows. A token is a varint v;
+// if (v & 1), it is a run of (v >> 1) zero residuals, otherwise it is a single residual with zigzag
+// value (v >> 1).
+//
+// ----------------------------------------------------------------------------------------------------
+
+// Encodes the image into 'out' (replacing its contents). 'stride' is the row step in floats.
+void encodeDepth(const float* data, int width, int height, int stride, std::vector<unsigned char>& out);
+
+// Decodes into 'out' (width * height floats, row-major). Returns false if the data is invalid.
+bool decodeDepth(const unsigned char* data, std::size_t size, int& width, int& height, std::vector<float>& out);
+
+// Format string used in sensor_msgs/CompressedImage messages that contain encoded depth
+extern const char* const DEPTH_CODEC_FORMAT;
+
+} // end namespace sim
+
+#endif
@@ -0,0 +1,29 @@
+#ifndef FAST_SIMULATOR2_ID_TABLE_H_
+#define FAST_SIMULATOR2_ID_TABLE_H_
+
+#include <string>
+
+namespace sim
+{
+
+// ----------------------------------------------------------------------------------------------------
+//
+// Process-wide table that interns IDs: each distinct ID gets a dense integer key (0, 1, 2, ...) the
+// first time it is interned. Keys are never reused, and the same ID always has the same key, so data
+// per ID can be stored in flat vectors indexed by the key instead of in maps keyed by strings. All
+// functions are thread-safe.
+//
+// ----------------------------------------------------------------------------------------------------
+
+// Returns the key of the ID, adding the ID to the table if it was not interned yet
+int internId(const std::string& id);
+
+// Returns false if the ID was never interned. Does not add it.
+bool findInternedId(const std::string& id, int& key);
+
+// Upper bound (exclusive) on the keys handed out so far
+unsigned int numInternedIds();
+
+} // end namespace sim
+
+#endif
@@ -0,0 +1,105 @@
+#ifndef FAST_SIMULATOR2_LASER_SCAN_H_
+#define FAST_SIMULATOR2_LASER_SCAN_H_
+
+#include "fast_simulator2/types.h"
+
+#include <geolib/datatypes.h>
+#include <geolib/Mesh.h>
+
+#include <vector>
+
+namespace sim
+{
+
+// ----------------------------------------------------------------------------------------------------
+//
+// Planar laser simulation in 2D. A planar laser only sees the intersection of the world with its scan
+// plane, so instead of rasterizing full meshes, the meshes are sliced by the plane once (PlaneSlicer)
+// and the beams are cast against the resulting line segments (BeamCaster). The slices stay valid as
+// long as the mesh and the plane do not change, so they can be cached while the laser moves within
+// the plane.
+//
+// ----------------------------------------------------------------------------------------------------
+
+struct LineSegment
+{
+    LineSegment() {}
+    LineSegment(float x1_, float y1_, float x2_, float y2_) : x1(x1_), y1(y1_), x2(x2_), y2(y2_) {}
+
+    float x1, y1, x2, y2;
+};
+
+// ----------------------------------------------------------------------------------------------------
+
+class PlaneSlicer
+{
+
+public:
+
+    // Transforms the mesh with 'pose' and appends the intersection of its triangles with the plane
+    // z = 0 to 'segments' (as x, y). Triangles that lie within the plane are ignored.
+    void slice(const geo::Mesh& mesh, const geo::Pose3D& pose, std::vector<LineSegment>& segments);
+
+private:
+
+    // Transformed points (kept to prevent re-allocation)
+    std::vector<geo::Vector3> points_;
+
+};
+
+// ----------------------------------------------------------------------------------------------------
+//
+// Casts the beams of a planar laser against line segments. Each segment is only tested against the
+// beams within its angular span. Those beams are tested several at a time (SIMD). Large scans are
+// split into sectors of beams that are cast in parallel on the thread pool.
+//
+// ----------------------------------------------------------------------------------------------------
+
+class BeamCaster
+{
+
+public:
+
+    BeamCaster();
+
+    // Beam i has angle angle_min + i * angle_increment
+    void configure(double angle_min, double angle_increment, unsigned int num_beams, double range_min,
+                   double range_max);
+
+    unsigned int numBeams() const { return cos_.size(); }
+
+    // Casts all beams from the origin (angle 0 along the x-axis) against the segments. Writes the
+    // distance to the closest hit of each beam into 'ranges' (numBeams() values), or 0 if there is no
+    // hit within the range limits. If a thread pool is given, sectors are cast in parallel (the calling
+    // thread helps while waiting).
+    void cast(const std::vector<LineSegment>& segments, float* ranges, ThreadPool* pool = 0);
+
+private:
+
+    // Segment with the beams it can hit. A segment that crosses the angle of -pi / pi can have two
+    // spans.
+    struct Span
+    {
+        int i_begin, i_end;
+
+        // Segment start point and direction
+        float x1, y1, ex, ey;
+    };
+
+    // Spans of the current cast (kept to prevent re-allocation)
+    std::vector<Span> spans_;
+
+    void castSector(int i_begin, int i_end, float* ranges) const;
+
+    double angle_min_, angle_increment_;
+
+    float range_min_, range_max_;
+
+    // Beam directions
+    std::vector<float> cos_, sin_;
+
+};
+
+} // end namespace sim
+
+#endif
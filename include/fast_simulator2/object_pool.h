@@ -0,0 +1,75 @@
+#ifndef FAST_SIMULATOR2_OBJECT_POOL_H_
+#define FAST_SIMULATOR2_OBJECT_POOL_H_
+
+#include <boost/shared_ptr.hpp>
+
+#include <vector>
+
+namespace sim
+{
+
+// ----------------------------------------------------------------------------------------------------
+//
+// Pool of reusable objects (frame buffers, messages). acquire() hands out an object that is no longer
+// referenced outside the pool, so a publisher or another thread can keep a shared pointer to an object
+// as long as it needs: the object is only reused after the last outside reference is released.
+// Reused objects keep their previous contents (and allocated capacity), so the caller must overwrite
+// all fields it uses.
+//
+// The pool holds at most 'capacity' objects. If all of them are still referenced (e.g. a consumer is
+// lagging behind), acquire() returns an empty pointer and the caller should drop the data instead of
+// letting the pool, and the memory it uses, grow without bound.
+//
+// acquire() must only be called from one thread at a time; the handed out objects can be released
+// from any thread.
+//
+// ----------------------------------------------------------------------------------------------------
+
+template<typename T>
+class ObjectPool
+{
+
+public:
+
+    typedef boost::shared_ptr<T> Ptr;
+
+    explicit ObjectPool(unsigned int capacity = 4) : capacity_(capacity > 0 ? capacity : 1) {}
+
+    // Returns an empty pointer if all objects are in use and the pool is full
+    Ptr acquire()
+    {
+        for(typename std::vector<Ptr>::const_iterator it = objects_.begin(); it != objects_.end(); ++it)
+        {
+            // Only referenced by the pool itself. Nobody else can obtain a new reference, so it is
+            // safe to hand it out.
+            if (it->unique())
+                return *it;
+        }
+
+        if (objects_.size() >= capacity_)
+            return Ptr();
+
+        Ptr obj(new T);
+        objects_.push_back(obj);
+        return obj;
+    }
+
+    // Number of objects created so far
+    unsigned int size() const { return objects_.size(); }
+
+    unsigned int capacity() const { return capacity_; }
+
+    // Objects already created are kept, even if there are more than the new capacity
+    void setCapacity(unsigned int capacity) { capacity_ = capacity > 0 ? capacity : 1; }
+
+private:
+
+    std::vector<Ptr> objects_;
+
+    unsigned int capacity_;
+
+};
+
+} // end namespace sim
+
+#endif
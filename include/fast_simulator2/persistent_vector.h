@@ -0,0 +1,160 @@
+#ifndef FAST_SIMULATOR2_PERSISTENT_VECTOR_H_
+#define FAST_SIMULATOR2_PERSISTENT_VECTOR_H_
+
+#include <boost/shared_ptr.hpp>
+#include <iterator>
+#include <vector>
+
+namespace sim
+{
+
+// ----------------------------------------------------------------------------------------------------
+//
+// Vector with structural sharing (a radix tree with 32-way branching). Copying a PersistentVector is
+// O(1): the copy shares all nodes with the original. Writing an element clones only the nodes on the
+// path from the root to that element that are shared with another vector, so the cost of a write is
+// O(log32(N)) regardless of how many copies exist. Nodes owned by a single vector are modified in place.
+//
+// Reading from a const PersistentVector is thread-safe, even while another copy is being modified.
+//
+// ----------------------------------------------------------------------------------------------------
+
+template<typename T>
+class PersistentVector
+{
+
+    static const unsigned int BITS = 5;
+    static const unsigned int WIDTH = 1 << BITS;
+    static const unsigned int MASK = WIDTH - 1;
+
+    struct Node;
+    typedef boost::shared_ptr<Node> NodePtr;
+
+    struct Node
+    {
+        std::vector<NodePtr> children;  // Only used by branch nodes
+        std::vector<T> values;          // Only used by leaf nodes
+    };
+
+public:
+
+    class const_iterator : public std::iterator<std::forward_iterator_tag, T>
+    {
+
+    public:
+
+        const_iterator(const PersistentVector* v, unsigned int i) : v_(v), i_(i), leaf_(0)
+        {
+            if (i_ < v_->size_)
+                leaf_ = v_->leafFor(i_);
+        }
+
+        const T& operator*() const { return leaf_->values[i_ & MASK]; }
+
+        const T* operator->() const { return &leaf_->values[i_ & MASK]; }
+
+        const_iterator& operator++()
+        {
+            ++i_;
+            if ((i_ & MASK) == 0 && i_ < v_->size_)
+                leaf_ = v_->leafFor(i_);
+            return *this;
+        }
+
+        bool operator==(const const_iterator& other) const { return i_ == other.i_; }
+
+        bool operator!=(const const_iterator& other) const { return i_ != other.i_; }
+
+        unsigned int index() const { return i_; }
+
+    private:
+
+        const PersistentVector* v_;
+        unsigned int i_;
+        const Node* leaf_;
+
+    };
+
+    PersistentVector() : size_(0), shift_(0) {}
+
+    unsigned int size() const { return size_; }
+
+    bool empty() const { return size_ == 0; }
+
+    const T& operator[](unsigned int i) const { return leafFor(i)->values[i & MASK]; }
+
+    void set(unsigned int i, const T& v) { mutableRef(i) = v; }
+
+    void push_back(const T& v)
+    {
+        if (!root_)
+        {
+            shift_ = 0;
+        }
+        else if (size_ == (WIDTH << shift_))
+        {
+            // Tree is full: add a level on top
+            NodePtr new_root(new Node);
+            new_root->children.resize(WIDTH);
+            new_root->children[0] = root_;
+            root_ = new_root;
+            shift_ += BITS;
+        }
+
+        mutableRef(size_) = v;
+        ++size_;
+    }
+
+    const_iterator begin() const { return const_iterator(this, 0); }
+
+    const_iterator end() const { return const_iterator(this, size_); }
+
+private:
+
+    NodePtr root_;
+
+    unsigned int size_;
+
+    // BITS * (depth of the tree - 1)
+    unsigned int shift_;
+
+    const Node* leafFor(unsigned int i) const
+    {
+        const Node* node = root_.get();
+        for(unsigned int level = shift_; level > 0; level -= BITS)
+            node = node->children[(i >> level) & MASK].get();
+        return node;
+    }
+
+    // Makes sure the node is owned by this vector only (cloning it if necessary) and returns it
+    static Node* editable(NodePtr& n, bool leaf)
+    {
+        if (!n)
+        {
+            n.reset(new Node);
+            if (leaf)
+                n->values.resize(WIDTH);
+            else
+                n->children.resize(WIDTH);
+        }
+        else if (!n.unique())
+        {
+            n.reset(new Node(*n));
+        }
+
+        return n.get();
+    }
+
+    T& mutableRef(unsigned int i)
+    {
+        Node* node = editable(root_, shift_ == 0);
+        for(unsigned int level = shift_; level > 0; level -= BITS)
+            node = editable(node->children[(i >> level) & MASK], level == BITS);
+        return node->values[i & MASK];
+    }
+
+};
+
+} // end namespace sim
+
+#endif
@@ -0,0 +1,167 @@
+#ifndef FAST_SIMULATOR2_PIPELINE_H_
+#define FAST_SIMULATOR2_PIPELINE_H_
+
+#include "fast_simulator2/thread_pool.h"
+
+#include <boost/bind.hpp>
+
+#include <vector>
+
+namespace sim
+{
+
+// ----------------------------------------------------------------------------------------------------
+//
+// FIFO queue with a fixed capacity. Pushing onto a full queue drops the oldest item, so a slow
+// consumer always gets the most recent data instead of blocking the producer. The items are stored in
+// a ring buffer that is allocated once, so pushing and popping do not allocate. Not thread-safe.
+//
+// ----------------------------------------------------------------------------------------------------
+
+template<typename T>
+class BoundedQueue
+{
+
+public:
+
+    BoundedQueue(unsigned int capacity) : items_(capacity > 0 ? capacity : 1), begin_(0), size_(0), num_dropped_(0) {}
+
+    // Returns false if the oldest item had to be dropped to make room
+    bool push(const T& item)
+    {
+        if (size_ == items_.size())
+        {
+            // Overwrite the oldest item, which makes the next one the oldest
+            items_[begin_] = item;
+            begin_ = (begin_ + 1) % items_.size();
+            ++num_dropped_;
+            return false;
+        }
+
+        items_[(begin_ + size_) % items_.size()] = item;
+        ++size_;
+        return true;
+    }
+
+    bool pop(T& item)
+    {
+        if (size_ == 0)
+            return false;
+
+        item = items_[begin_];
+
+        // Do not keep the popped item alive in the buffer
+        items_[begin_] = T();
+
+        begin_ = (begin_ + 1) % items_.size();
+        --size_;
+        return true;
+    }
+
+    unsigned int size() const { return size_; }
+
+    bool empty() const { return size_ == 0; }
+
+    unsigned int capacity() const { return items_.size(); }
+
+    unsigned long numDropped() const { return num_dropped_; }
+
+private:
+
+    std::vector<T> items_;
+
+    // Index of the oldest item
+    unsigned int begin_;
+
+    unsigned int size_;
+
+    unsigned long num_dropped_;
+
+};
+
+// ----------------------------------------------------------------------------------------------------
+//
+// Stage of a processing pipeline (e.g. render -> encode -> publish). Items pushed into the stage are
+// handled in order by a task on the thread pool, so the producer can continue with the next item
+// while the previous one is being handled. At most one task per stage runs at a time, and it is only
+// scheduled while there are items queued. The input queue is bounded with drop-oldest semantics.
+//
+// ----------------------------------------------------------------------------------------------------
+
+template<typename T>
+class PipelineStage
+{
+
+public:
+
+    typedef boost::function<void(const T&)> Handler;
+
+    PipelineStage(ThreadPool& pool, const Handler& handler, unsigned int capacity = 1)
+        : handler_(handler), queue_(capacity), running_(false), tasks_(pool) {}
+
+    ~PipelineStage() { tasks_.wait(); }
+
+    // Returns false if an older item was dropped because the queue was full
+    bool push(const T& item)
+    {
+        bool added, start = false;
+
+        {
+            boost::lock_guard<boost::mutex> lg(mutex_);
+            added = queue_.push(item);
+            if (!running_)
+                start = running_ = true;
+        }
+
+        if (start)
+            tasks_.run(boost::bind(&PipelineStage::run, this));
+
+        return added;
+    }
+
+    // Blocks until all queued items are handled
+    void wait() { tasks_.wait(); }
+
+    unsigned long numDropped() const
+    {
+        boost::lock_guard<boost::mutex> lg(mutex_);
+        return queue_.numDropped();
+    }
+
+private:
+
+    Handler handler_;
+
+    mutable boost::mutex mutex_;
+
+    BoundedQueue<T> queue_;
+
+    // True while a task is handling the queue
+    bool running_;
+
+    // Declared last, so it is destroyed (and waited for) before the other members
+    TaskGroup tasks_;
+
+    void run()
+    {
+        T item;
+        while(true)
+        {
+            {
+                boost::lock_guard<boost::mutex> lg(mutex_);
+                if (!queue_.pop(item))
+                {
+                    running_ = false;
+                    return;
+                }
+            }
+
+            handler_(item);
+        }
+    }
+
+};
+
+} // end namespace sim
+
+#endif
@@ -5,10 +5,16 @@
 #define SIM_REGISTER_PLUGIN(Derived) CLASS_LOADER_REGISTER_CLASS(Derived, sim::Plugin)
 
 #include "fast_simulator2/types.h"
+#include "fast_simulator2/render_service.h"
 
 #include <tue/config/configuration.h>
 #include <ed/types.h>
 
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/locks.hpp>
+
+#include <map>
+
 namespace sim
 {
 
@@ -19,22 +25,108 @@ class Plugin
 
 public:
 
-    Plugin() {}
+    Plugin() : thread_pool_(0), render_service_(0) {}
 
     virtual void configure(tue::Configuration config, const sim::LUId& obj_id) {}
 
     virtual void initialize() {}
 
-    virtual void process(const ed::WorldModel& world, double dt, ed::UpdateRequest& req) {}
+    // 'time' is the simulated time (in seconds) of the world snapshot, 'dt' the time step
+    virtual void process(const World& world, double time, double dt, ed::UpdateRequest& req) {}
 
-    virtual void process(const ed::WorldModel& world, const LUId& obj_id, double dt, ed::UpdateRequest& req) {}
+    virtual void process(const World& world, const LUId& obj_id, double time, double dt, ed::UpdateRequest& req) {}
 
     const std::string& name() const { return name_; }
 
+    // Thread pool shared by all plugins. Heavy plugins can use it to split their processing into
+    // tasks (see TaskGroup). Available from configure() on.
+    ThreadPool& threadPool() const { return *thread_pool_; }
+
+    // Renders the cameras of all plugins. Available from configure() on.
+    RenderService& renderService() const { return *render_service_; }
+
+    // Registers a camera with the render service (call from configure()). Returns the view ID to
+    // render with. Views of plugins that are due in the same step are rendered as one batch.
+    int addRenderView(const geo::DepthCamera& camera, const Frustum& frustum)
+    {
+        int view = render_service_->addView(camera, frustum, this);
+        render_views_.push_back(view);
+        return view;
+    }
+
+    // In-process demand for an output of this plugin (identified by its topic name), for consumers
+    // that are not ROS subscribers. Demands are counted: every addDemand() must be matched by a
+    // removeDemand(). Can be called from any thread.
+    void addDemand(const std::string& output)
+    {
+        boost::lock_guard<boost::mutex> lg(mutex_demand_);
+        ++demand_[output];
+    }
+
+    void removeDemand(const std::string& output)
+    {
+        boost::lock_guard<boost::mutex> lg(mutex_demand_);
+        std::map<std::string, int>::iterator it = demand_.find(output);
+        if (it != demand_.end() && --it->second <= 0)
+            demand_.erase(it);
+    }
+
+    bool hasDemand(const std::string& output) const
+    {
+        boost::lock_guard<boost::mutex> lg(mutex_demand_);
+        return demand_.find(output) != demand_.end();
+    }
+
+    // Reports a value in the diagnostics of the plugin (e.g. a setting the plugin adapts at run time).
+    // Can be called from any thread.
+    void setDiagnostic(const std::string& key, double value)
+    {
+        boost::lock_guard<boost::mutex> lg(mutex_demand_);
+        diagnostics_[key] = value;
+    }
+
+    std::map<std::string, double> diagnostics() const
+    {
+        boost::lock_guard<boost::mutex> lg(mutex_demand_);
+        return diagnostics_;
+    }
+
+    // Returns true if the output of the publisher is consumed by anyone: a subscriber or an
+    // in-process consumer. Plugins should skip producing outputs that are not demanded.
+    template<typename Publisher>
+    bool demanded(const Publisher& pub) const
+    {
+        return pub.getNumSubscribers() > 0 || hasDemand(pub.getTopic());
+    }
+
+    template<typename Publisher>
+    bool demanded(const std::vector<Publisher>& pubs) const
+    {
+        for(typename std::vector<Publisher>::const_iterator it = pubs.begin(); it != pubs.end(); ++it)
+        {
+            if (demanded(*it))
+                return true;
+        }
+        return false;
+    }
+
 private:
 
+    // Protects demand_ and diagnostics_
+    mutable boost::mutex mutex_demand_;
+
+    std::map<std::string, int> demand_;
+
+    std::map<std::string, double> diagnostics_;
+
     std::string name_;
 
+    ThreadPool* thread_pool_;
+
+    RenderService* render_service_;
+
+    std::vector<int> render_views_;
+
 };
 
 } // end namespace sim
@@ -0,0 +1,31 @@
+#ifndef FAST_SIMULATOR2_POINT_CLOUD_H_
+#define FAST_SIMULATOR2_POINT_CLOUD_H_
+
+namespace sim
+{
+
+// ----------------------------------------------------------------------------------------------------
+//
+// Back-projection of depth images into organized point clouds.
+//
+// Each point is x, y, z (float) followed by 4 bytes of padding: 16 bytes per point, the layout of
+// pcl::PointXYZ. Points are in the camera frame (x right, y down, z forward). Pixels without depth
+// (0) become points with NaN coordinates, so the cloud keeps one point per pixel.
+//
+// Rows are independent, so large images can be converted by several threads, each taking a range
+// of rows.
+//
+// ----------------------------------------------------------------------------------------------------
+
+// Size of a point in bytes
+const int POINT_STEP = 16;
+
+// Converts rows [row_begin, row_end) of the depth image. 'stride' is the row step of the depth image in
+// floats. 'points' points to the start of the whole cloud (width * height points). The intrinsics are
+// those of the pinhole model: u = fx * x / z + cx, v = fy * y / z + cy.
+void depthToPoints(const float* depth, int width, int stride, int row_begin, int row_end,
+                   float fx, float fy, float cx, float cy, float* points);
+
+} // end namespace sim
+
+#endif
@@ -0,0 +1,182 @@
+#ifndef FAST_SIMULATOR2_RENDER_SERVICE_H_
+#define FAST_SIMULATOR2_RENDER_SERVICE_H_
+
+#include "fast_simulator2/types.h"
+#include "fast_simulator2/spatial_index.h"
+#include "fast_simulator2/depth_buffer.h"
+
+#include <geolib/sensors/DepthCamera.h>
+
+#include <boost/thread/mutex.hpp>
+
+#include <vector>
+
+namespace sim
+{
+
+// ----------------------------------------------------------------------------------------------------
+//
+// Renders the depth images of all cameras that are due in the same simulator step as one batch.
+// Cameras register a view (see Plugin::addRenderView()). When the simulator starts the cycles of the
+// plugins that own views, it tells the service which views to expect. A render() call then blocks
+// until every expected view has either been submitted or been released (its plugin finished its
+// cycle without rendering). The thread that completes the batch renders it:
+//
+//   - the entities within the view frustums are collected once: an entity that is seen by several
+//     views is looked up (shape, pose, triangle count) only once;
+//   - the work of all views is split into tasks with roughly the same number of triangles, so a
+//     batch of cameras keeps the whole thread pool busy instead of each camera doing so in turn.
+//
+// Waiting threads help executing tasks of the thread pool, so a plugin that blocks in render() does
+// not prevent the other plugins of the batch from running.
+//
+// ----------------------------------------------------------------------------------------------------
+
+class RenderService
+{
+
+public:
+
+    RenderService(ThreadPool& pool);
+
+    ~RenderService();
+
+    // Registers a camera. 'frustum' is the view frustum in the camera frame (see Frustum::camera()).
+    // 'owner' identifies the views that are rendered by the same thread (e.g. the plugin). Returns the
+    // view ID. Views are only added and removed during configuration, while no views are rendered:
+    // rendering reads the views without locking (the simulator waits for all running plugins before
+    // it configures).
+    int addView(const geo::DepthCamera& camera, const Frustum& frustum, const void* owner = 0);
+
+    // Removes all views of the owner (e.g. when the plugin is destroyed). Their IDs may be reused by
+    // views that are added later. Same restrictions as addView().
+    void removeViews(const void* owner);
+
+    // Changes the camera of the view (e.g. its resolution). May only be called by the owner of the view,
+    // outside render().
+    void setViewCamera(int view, const geo::DepthCamera& camera) { views_[view].camera = camera; }
+
+    // - - - - - - - - - - - - - - - Scheduling - - - - - - - - - - - - - - -
+
+    // Starts a batch with the given views. Their owners started a cycle and may call render().
+    void expect(const std::vector<int>& views);
+
+    // The owner of the views finished its cycle. Stops waiting for the views that were expected but
+    // not rendered.
+    void release(const std::vector<int>& views);
+
+    // - - - - - - - - - - - - - - - Rendering - - - - - - - - - - - - - - -
+
+    // Renders the view into 'buffer' (which must be cleared), with the world index + 1 of each entity
+    // as label if the buffer has labels. 'camera_pose' is the pose of the camera (x right, y down,
+    // z forward) in the world frame. If given, 'visible_entities' receives the indices of the entities
+    // that were rendered. Blocks until the batch of the view has been rendered. Views that were not
+    // expected are rendered right away, on their own. Other views of the same owner that are expected
+    // in the batch are released: the owner cannot render them while it waits.
+    void render(int view, const World& world, const geo::Pose3D& camera_pose, const DepthBuffer& buffer,
+                std::vector<int>* visible_entities = 0);
+
+private:
+
+    ThreadPool& pool_;
+
+    struct View
+    {
+        View() : owner(0), in_use(false) {}
+
+        geo::DepthCamera camera;
+        Frustum frustum;
+        const void* owner;
+
+        // False if the view was removed (its slot can be reused)
+        bool in_use;
+
+        // A view is rendered by at most one batch at a time, so the members below need no locking
+
+        // Buffers of the tasks that render part of the view, besides the first one (which renders into
+        // the buffer of the request)
+        std::vector<std::vector<float> > depth_scratch;
+        std::vector<std::vector<int> > label_scratch;
+
+        // Entities within the frustum (indices into Context::entities), and the prefix sums of their triangle
+        // counts
+        std::vector<unsigned int> visible;
+        std::vector<unsigned long> num_triangles;
+    };
+
+    std::vector<View> views_;
+
+    struct Request
+    {
+        int view;
+        const World* world;
+        geo::Pose3D camera_pose;
+        DepthBuffer buffer;
+        std::vector<int>* visible_entities;
+    };
+
+    struct Batch
+    {
+        Batch() : num_outstanding(0), done(false) {}
+
+        // Number of expected views that are neither submitted nor released
+        unsigned int num_outstanding;
+
+        std::vector<Request> requests;
+
+        bool done;
+    };
+
+    typedef boost::shared_ptr<Batch> BatchPtr;
+
+    boost::mutex mutex_;
+
+    // Batch each view is expected in (empty if the view is not expected)
+    std::vector<BatchPtr> view_batches_;
+
+    struct Entity
+    {
+        int index;
+
+        // Mesh and its pose in the world frame. Points into the world snapshot of the batch.
+        const geo::Mesh* mesh;
+        geo::Pose3D pose;
+        unsigned long num_triangles;
+    };
+
+    // State of a batch that is being rendered. Batches can be rendered concurrently (and even nested:
+    // a thread waiting for render tasks may pick up a plugin that renders another batch), so each
+    // takes its own context. Contexts are kept for reuse.
+    struct Context
+    {
+        // Entities within any of the frustums of the batch
+        std::vector<Entity> entities;
+
+        // Index into 'entities' per world index (-1 if not within any frustum)
+        std::vector<int> entity_slots;
+
+        std::vector<int> query_result;
+    };
+
+    std::vector<Context*> free_contexts_;
+
+    void finishBatch(const BatchPtr& batch);
+
+    void waitForBatch(const BatchPtr& batch);
+
+    bool batchDone(const BatchPtr& batch);
+
+    void renderBatch(const std::vector<Request>& requests);
+
+    void renderWorld(Context& context, const std::vector<const Request*>& requests);
+
+    void renderTask(const Context* context, const Request& req, const geo::Pose3D& camera_pose_inv,
+                    unsigned int i_begin, unsigned int i_end, DepthBuffer buffer, bool clear);
+
+    void mergeTask(const Request& req, unsigned int num_buffers, int row_begin, int row_end);
+
+};
+
+} // end namespace sim
+
+#endif
@@ -0,0 +1,120 @@
+#ifndef FAST_SIMULATOR2_SHARED_IMAGE_RING_H_
+#define FAST_SIMULATOR2_SHARED_IMAGE_RING_H_
+
+#include <boost/interprocess/shared_memory_object.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+
+#include <stdint.h>
+#include <string>
+
+namespace sim
+{
+
+// Small descriptor of a frame in the ring. This is all a consumer receives per frame.
+struct SharedFrameDescriptor
+{
+    SharedFrameDescriptor() : slot(0), sequence(0), stamp(0) {}
+
+    unsigned int slot;
+    uint64_t sequence;   // 1 for the first frame, incremented for each frame
+    double stamp;
+};
+
+// ----------------------------------------------------------------------------------------------------
+//
+// Ring of image slots in shared memory, for passing images to processes on the same machine without
+// copying or serializing them. The writer renders directly into the next slot and commits it; readers
+// wait for a new descriptor and read the slot in place.
+//
+// The writer never waits for readers: it overwrites the slots round-robin. A reader that is still busy
+// with a slot when it is overwritten finds out with isValid(), which it should call after it is done
+// with the data. With N slots, a reader has N - 1 frame periods to process a frame.
+//
+// Readers are not counted but leave a heartbeat (see hasReaders()), so a reader that crashes does not
+// keep the writer producing frames. The ring is protected by an interprocess mutex that is not robust:
+// a process that crashes while holding it blocks the others. It is only held for a few reads and
+// writes of the header (never while a frame is written or read), so this takes a crash in exactly
+// that window; restarting the writer creates a new ring.
+//
+// ----------------------------------------------------------------------------------------------------
+
+class SharedImageRing
+{
+
+public:
+
+    SharedImageRing();
+
+    ~SharedImageRing();
+
+    // Writer: creates the shared memory (replacing any existing memory with the same name)
+    bool create(const std::string& name, int width, int height, int bytes_per_pixel, const std::string& encoding,
+                unsigned int num_slots, std::string& error);
+
+    // Reader: attaches to shared memory created by a writer
+    bool open(const std::string& name, std::string& error);
+
+    // Detaches (and, for the writer, removes the shared memory). Also done on destruction.
+    void close();
+
+    bool isOpen() const { return header_ != 0; }
+
+    int width() const;
+
+    int height() const;
+
+    // Row step in bytes
+    int step() const;
+
+    std::string encoding() const;
+
+    unsigned int numSlots() const;
+
+    // - - - - - - - - - - - - - - - Writer - - - - - - - - - - - - - - -
+
+    // True if a reader was active in the last READER_TIMEOUT seconds: it attached, waited for a frame
+    // or checked one. Readers that are waiting for a frame renew their heartbeat while they wait.
+    bool hasReaders() const;
+
+    static const double READER_TIMEOUT;
+
+    // Returns the slot to write the next frame into. Invalidates the frame that was in it.
+    unsigned char* beginWrite();
+
+    // Publishes the slot returned by beginWrite() to the readers
+    SharedFrameDescriptor commit(double stamp);
+
+    // - - - - - - - - - - - - - - - Reader - - - - - - - - - - - - - - -
+
+    // Waits for a frame newer than 'sequence'. Returns false on timeout.
+    bool waitForFrame(uint64_t sequence, double timeout, SharedFrameDescriptor& frame) const;
+
+    const unsigned char* data(const SharedFrameDescriptor& frame) const;
+
+    // False if the slot of the frame has been (or is being) overwritten since it was committed
+    bool isValid(const SharedFrameDescriptor& frame) const;
+
+private:
+
+    struct Header;
+
+    std::string name_;
+
+    bool is_writer_;
+
+    boost::interprocess::shared_memory_object shm_;
+
+    boost::interprocess::mapped_region region_;
+
+    Header* header_;
+
+    unsigned char* slots_;
+
+    // Slot that is being written (writer only)
+    unsigned int write_slot_;
+
+};
+
+} // end namespace sim
+
+#endif
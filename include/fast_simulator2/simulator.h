@@ -2,6 +2,9 @@
 #define FAST_SIMULATOR2_SIMULATOR_H_
 
 #include "fast_simulator2/types.h"
+#include "fast_simulator2/thread_pool.h"
+#include "fast_simulator2/render_service.h"
+#include "fast_simulator2/stats.h"
 
 #include <ed/types.h>
 #include <ed/models/model_loader.h>
@@ -30,18 +33,69 @@ public:
     PluginContainerPtr loadPlugin(const std::string plugin_name, const std::string& lib_filename,
                                   tue::Configuration config, std::string& error);
 
-    const ed::WorldModelConstPtr& world() const { return world_; }
+    // Adds a plugin instance that is not loaded from a library (e.g., for testing and benchmarking).
+    // The configuration may contain the same '_object', '_frequency' and '_event_driven' fields that
+    // are set for plugins of objects.
+    PluginContainerPtr addPlugin(const std::string plugin_name, const PluginPtr& plugin, tue::Configuration config,
+                                 std::string& error);
+
+    const WorldConstPtr& world() const { return world_; }
+
+    // Returns the plugin with the given name, or an empty pointer if it does not exist
+    PluginPtr plugin(const std::string& name) const;
+
+    // Simulated time in seconds. Starts at 0 and advances with dt every step
+    double time() const { return time_; }
 
     void addPluginPath(const std::string& path) { plugin_paths_.push_back(path); }
 
+    // In lockstep mode, step() lets all plugins that are due process the current world in parallel,
+    // waits until they are all finished and then merges their update requests in a fixed order. This
+    // makes simulation runs reproducible. Otherwise, step() does not wait for the plugins: their
+    // update requests are merged in the first step after they finish.
+    void setLockstep(bool lockstep) { lockstep_ = lockstep; }
+
+    bool lockstep() const { return lockstep_; }
+
+    // Performance statistics of the simulator itself. Should not be called concurrently with step().
+    const SimulatorStats& stats() const { return stats_; }
+
+    // Performance statistics per plugin (plugin name -> statistics)
+    void getPluginStats(std::map<std::string, PluginStats>& stats) const;
+
 private:
 
-    ed::WorldModelConstPtr world_;
+    WorldConstPtr world_;
+
+    double time_;
+
+    bool lockstep_;
+
+    SimulatorStats stats_;
+
+    //! Plugins are executed as tasks on a shared thread pool
+    ThreadPool thread_pool_;
+    TaskGroup plugin_tasks_;
+
+    RenderService render_service_;
+
+    // Plugins started in the current step, with their time step, and the render views they own
+    // (kept to prevent re-allocation every step)
+    std::vector<std::pair<PluginContainerPtr, double> > started_plugins_;
+    std::vector<int> due_render_views_;
 
-    //! Plugins
     std::vector<std::string> plugin_paths_;
     std::map<std::string, PluginContainerPtr> plugin_containers_;
 
+    // True if the world changed since the plugins were last started (in the previous step in lockstep
+    // mode, or by configure())
+    bool world_changed_;
+
+    void startPlugins(bool world_changed);
+
+    // Returns true if the world changed
+    bool mergeUpdateRequests();
+
     // Models
     std::map<std::string, std::string> models_;
 
@@ -51,6 +105,9 @@ private:
 
     void createObject(LUId parent_id, tue::Configuration config, ed::UpdateRequest& req);
 
+    // Objects that are marked static in the configuration
+    std::vector<UUId> static_ids_;
+
     tue::config::DataPointer loadModelData(const std::string& type);
 
     std::string getFullLibraryPath(const std::string& lib);
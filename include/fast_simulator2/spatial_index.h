@@ -0,0 +1,223 @@
+#ifndef FAST_SIMULATOR2_SPATIAL_INDEX_H_
+#define FAST_SIMULATOR2_SPATIAL_INDEX_H_
+
+#include "fast_simulator2/persistent_vector.h"
+
+#include <geolib/datatypes.h>
+
+#include <vector>
+
+namespace sim
+{
+
+// ----------------------------------------------------------------------------------------------------
+
+// Axis-aligned bounding box
+struct BoundingBox
+{
+    BoundingBox() : min(1e30, 1e30, 1e30), max(-1e30, -1e30, -1e30) {}
+
+    BoundingBox(const geo::Vec3& min_, const geo::Vec3& max_) : min(min_), max(max_) {}
+
+    bool empty() const { return min.x > max.x || min.y > max.y || min.z > max.z; }
+
+    bool intersects(const BoundingBox& b) const
+    {
+        return min.x <= b.max.x && b.min.x <= max.x && min.y <= b.max.y && b.min.y <= max.y
+                && min.z <= b.max.z && b.min.z <= max.z;
+    }
+
+    void add(const geo::Vec3& p);
+
+    void add(const BoundingBox& b);
+
+    // Returns the bounding box of this box after transforming it with 'pose'
+    BoundingBox transformed(const geo::Pose3D& pose) const;
+
+    geo::Vec3 min, max;
+};
+
+// ----------------------------------------------------------------------------------------------------
+
+struct Sphere
+{
+    Sphere() : radius(0) {}
+
+    Sphere(const geo::Vec3& center_, double radius_) : center(center_), radius(radius_) {}
+
+    bool intersects(const BoundingBox& box) const;
+
+    BoundingBox bounds() const;
+
+    geo::Vec3 center;
+    double radius;
+};
+
+// ----------------------------------------------------------------------------------------------------
+
+// Region within 'half_thickness' of the plane through 'center' with normal 'normal' (unit length), e.g.
+// the scan plane of a laser. If radius > 0, the region is limited to the sphere with that radius
+// around the center.
+struct Slab
+{
+    Slab() : half_thickness(0), radius(0) {}
+
+    Slab(const geo::Vec3& center_, const geo::Vec3& normal_, double half_thickness_, double radius_ = 0)
+        : center(center_), normal(normal_), half_thickness(half_thickness_), radius(radius_) {}
+
+    // Conservative test: may return true for boxes that are just outside the slab and sphere
+    bool intersects(const BoundingBox& box) const;
+
+    bool bounded() const { return radius > 0; }
+
+    // Only valid if bounded
+    BoundingBox bounds() const;
+
+    geo::Vec3 center, normal;
+    double half_thickness, radius;
+};
+
+// ----------------------------------------------------------------------------------------------------
+
+// Convex volume bounded by planes. A point p is inside if n.dot(p) >= d for all planes (n, d).
+class Frustum
+{
+
+public:
+
+    Frustum() : num_planes_(0), bounded_(false) {}
+
+    // At most MAX_PLANES planes can be added
+    void addPlane(const geo::Vec3& normal, double offset);
+
+    // Limits queries to the given box, which must contain the frustum
+    void setBounds(const BoundingBox& bounds) { bounds_ = bounds; bounded_ = true; }
+
+    bool bounded() const { return bounded_; }
+
+    // Only valid if bounded
+    const BoundingBox& bounds() const { return bounds_; }
+
+    // Returns the frustum transformed with 'pose'
+    Frustum transformed(const geo::Pose3D& pose) const;
+
+    // Conservative test: may return true for boxes that are just outside the frustum
+    bool intersects(const BoundingBox& box) const;
+
+    // Camera frustum (in the camera frame: x right, y down, z forward) with the given half-angle
+    // tangents. If far <= 0, the frustum is not bounded in depth; otherwise it is bounded.
+    static Frustum camera(double tan_left, double tan_right, double tan_top, double tan_bottom,
+                          double near, double far = 0);
+
+private:
+
+    struct Plane
+    {
+        Plane() : offset(0) {}
+        Plane(const geo::Vec3& normal_, double offset_) : normal(normal_), offset(offset_) {}
+        geo::Vec3 normal;
+        double offset;
+    };
+
+    static const unsigned int MAX_PLANES = 8;
+
+    // Fixed-size, so frustums can be created and transformed every frame without allocating
+    Plane planes_[MAX_PLANES];
+
+    unsigned int num_planes_;
+
+    bool bounded_;
+    BoundingBox bounds_;
+
+};
+
+// ----------------------------------------------------------------------------------------------------
+//
+// Spatial index over entity bounding boxes: a uniform grid of which the cells are hashed into a fixed
+// number of buckets. Like the rest of the World, all data is stored in persistent vectors, so copying
+// the index is O(1) and moving an entity only touches the buckets of the cells it leaves and enters
+// (or none at all if it stays within the same cells). Entities that span many cells (floors, walls)
+// are kept in a separate list that is checked on every query.
+//
+// ----------------------------------------------------------------------------------------------------
+
+class SpatialIndex
+{
+
+public:
+
+    SpatialIndex(double cell_size = 1.0);
+
+    // Inserts entity 'idx' or updates its bounding box
+    void set(int idx, const BoundingBox& box);
+
+    void remove(int idx);
+
+    // Returns false if the entity is not in the index
+    bool bounds(int idx, BoundingBox& box) const;
+
+    // Finds the (sorted) indices of all entities of which the bounding box intersects the query
+    void query(const BoundingBox& box, std::vector<int>& indices) const;
+
+    // The work of these queries depends on the size of the queried volume, unless it is unbounded
+    // (a frustum without far plane, a slab without radius): then all cells of the world are visited.
+
+    void query(const Frustum& frustum, std::vector<int>& indices) const;
+
+    void query(const Sphere& sphere, std::vector<int>& indices) const;
+
+    void query(const Slab& slab, std::vector<int>& indices) const;
+
+    unsigned int size() const { return num_entries_; }
+
+private:
+
+    struct CellRange
+    {
+        int min[3], max[3];
+        unsigned long numCells() const;
+        bool operator==(const CellRange& r) const;
+    };
+
+    struct Entry
+    {
+        Entry() : valid(false), large(false) {}
+        BoundingBox box;
+        CellRange cells;
+        bool valid;
+        bool large;
+    };
+
+    typedef boost::shared_ptr<const std::vector<int> > IndexListConstPtr;
+
+    double cell_size_;
+
+    unsigned int num_entries_;
+
+    PersistentVector<Entry> entries_;
+
+    // Hashed grid cell -> indices of the entities overlapping the cell
+    PersistentVector<IndexListConstPtr> buckets_;
+
+    // Entities that overlap too many cells to be stored in the grid
+    IndexListConstPtr large_;
+
+    // Union of all boxes that were ever inserted (never shrinks)
+    BoundingBox extent_;
+
+    CellRange cellRange(const BoundingBox& box) const;
+
+    unsigned int bucketFor(int x, int y, int z) const;
+
+    void addToCells(int idx, const Entry& e);
+
+    void removeFromCells(int idx, const Entry& e);
+
+    template<typename Query>
+    void queryCells(const CellRange& range, const Query& q, std::vector<int>& indices) const;
+
+};
+
+} // end namespace sim
+
+#endif
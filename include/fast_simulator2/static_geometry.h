@@ -0,0 +1,75 @@
+#ifndef FAST_SIMULATOR2_STATIC_GEOMETRY_H_
+#define FAST_SIMULATOR2_STATIC_GEOMETRY_H_
+
+#include "fast_simulator2/persistent_vector.h"
+#include "fast_simulator2/spatial_index.h"
+
+#include <geolib/Mesh.h>
+
+#include <boost/shared_ptr.hpp>
+
+namespace sim
+{
+
+// ----------------------------------------------------------------------------------------------------
+//
+// Cache of the geometry of entities that do not move (walls, furniture), transformed to the world
+// frame once. Sensors can use these meshes directly instead of looking up and transforming the shape
+// of each entity every frame; only the dynamic entities need that.
+//
+// Part of the World snapshot: like the rest of the World, it is stored in persistent vectors, so
+// copying it is O(1) and adding or removing a static entity only touches that entity. Unchanged
+// parts are shared between snapshots.
+//
+// ----------------------------------------------------------------------------------------------------
+
+class StaticGeometry
+{
+
+public:
+
+    struct Part
+    {
+        // Mesh of the entity in the world frame
+        geo::Mesh mesh;
+
+        BoundingBox bounds;
+    };
+
+    typedef boost::shared_ptr<const Part> PartConstPtr;
+
+    StaticGeometry();
+
+    // Caches the mesh of entity 'idx', which has the given pose. Replaces the previous part, if any.
+    void set(int idx, const geo::Mesh& mesh, const geo::Pose3D& pose);
+
+    void remove(int idx);
+
+    bool isStatic(int idx) const { return idx < (int)parts_.size() && parts_[idx]; }
+
+    // Returns the part of the entity (empty if the entity is not static)
+    const PartConstPtr& part(int idx) const { return parts_[idx]; }
+
+    // Index of the world-frame bounding boxes of the parts
+    const SpatialIndex& spatialIndex() const { return index_; }
+
+    unsigned int numParts() const { return index_.size(); }
+
+    // Changes whenever a part is added, replaced or removed. Can be used to keep derived data (e.g. a
+    // cache per sensor) as long as the static geometry does not change.
+    unsigned long revision() const { return revision_; }
+
+private:
+
+    // Entity index -> part (empty if the entity is not static)
+    PersistentVector<PartConstPtr> parts_;
+
+    SpatialIndex index_;
+
+    unsigned long revision_;
+
+};
+
+} // end namespace sim
+
+#endif
@@ -0,0 +1,102 @@
+#ifndef FAST_SIMULATOR2_STATS_H_
+#define FAST_SIMULATOR2_STATS_H_
+
+#include <map>
+#include <string>
+#include <vector>
+
+namespace sim
+{
+
+// ----------------------------------------------------------------------------------------------------
+//
+// Histogram of durations with logarithmic buckets: bucket i holds durations in [2^i, 2^(i+1)) us.
+//
+// ----------------------------------------------------------------------------------------------------
+
+class Histogram
+{
+
+public:
+
+    Histogram();
+
+    void add(double seconds);
+
+    unsigned long count() const { return count_; }
+
+    double mean() const { return count_ > 0 ? sum_ / count_ : 0; }
+
+    double max() const { return max_; }
+
+    // Returns an upper bound (in seconds) of the p-th percentile, p in [0, 1]
+    double percentile(double p) const;
+
+    const std::vector<unsigned long>& buckets() const { return buckets_; }
+
+private:
+
+    std::vector<unsigned long> buckets_;
+
+    unsigned long count_;
+
+    double sum_;
+
+    double max_;
+
+};
+
+// ----------------------------------------------------------------------------------------------------
+
+struct PluginStats
+{
+    PluginStats() : configured_frequency(0), num_cycles(0), t_first_cycle(0), t_last_cycle(0),
+        skipped_request_pending(0), skipped_busy(0) {}
+
+    // Duration (wall-clock) of the process() calls
+    Histogram process_time;
+
+    // Time (wall-clock) between handing an update request to the simulator and the simulator taking it
+    // to merge it. The plugin cannot start a new cycle in the meantime (see skipped_request_pending).
+    Histogram request_latency;
+
+    double configured_frequency;
+
+    unsigned long num_cycles;
+
+    // Simulated time of the first and last cycle
+    double t_first_cycle, t_last_cycle;
+
+    // Cycles that were skipped because the update request of the previous cycle was not merged yet
+    unsigned long skipped_request_pending;
+
+    // Cycles that were skipped because the previous cycle was still running
+    unsigned long skipped_busy;
+
+    // Values reported by the plugin itself (see Plugin::setDiagnostic())
+    std::map<std::string, double> values;
+
+    // Average number of cycles per simulated second
+    double achievedFrequency() const
+    {
+        return num_cycles > 1 && t_last_cycle > t_first_cycle ? (num_cycles - 1) / (t_last_cycle - t_first_cycle) : 0;
+    }
+};
+
+// ----------------------------------------------------------------------------------------------------
+
+struct SimulatorStats
+{
+    // Duration of copying the world snapshot before it is updated
+    Histogram world_copy_time;
+
+    // Duration of merging (World::update) all update requests of one step
+    Histogram merge_time;
+
+    // Duration of calculating the poses of all entities (World::preparePoses) for the plugins that start
+    Histogram poses_time;
+};
+
+} // end namespace sim
+
+#endif
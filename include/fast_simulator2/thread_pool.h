@@ -0,0 +1,147 @@
+#ifndef FAST_SIMULATOR2_THREAD_POOL_H_
+#define FAST_SIMULATOR2_THREAD_POOL_H_
+
+#include <boost/function.hpp>
+#include <boost/thread.hpp>
+
+#include <deque>
+#include <vector>
+
+namespace sim
+{
+
+typedef boost::function<void()> Task;
+
+// ----------------------------------------------------------------------------------------------------
+//
+// Fixed-size work-stealing thread pool. Every worker has its own task queue. Tasks submitted from a
+// worker go to the back of its own queue and are executed LIFO by that worker; idle workers steal
+// from the front of the other queues. Tasks submitted from outside the pool are distributed over
+// the queues round-robin.
+//
+// ----------------------------------------------------------------------------------------------------
+
+class ThreadPool
+{
+
+public:
+
+    // If num_threads is 0, the number of hardware threads is used
+    ThreadPool(unsigned int num_threads = 0);
+
+    ~ThreadPool();
+
+    void submit(const Task& task);
+
+    // Executes one queued task on the calling thread. Returns false if there were no queued tasks.
+    bool runPendingTask();
+
+    // Blocks until done() returns true, executing queued tasks in the meantime. done() is checked
+    // again whenever a task is queued or notifyWaiters() is called, so whatever makes it true must
+    // call notifyWaiters() afterwards.
+    template<typename Predicate>
+    void waitUntil(const Predicate& done)
+    {
+        while(true)
+        {
+            unsigned long generation;
+            {
+                boost::lock_guard<boost::mutex> lg(mutex_wakeup_);
+                generation = generation_;
+            }
+
+            if (done())
+                return;
+
+            if (runPendingTask())
+                continue;
+
+            // Nothing to help with: sleep until a task is queued or a waiter may be done
+            boost::unique_lock<boost::mutex> lock(mutex_wakeup_);
+            ++num_waiters_;
+            while(generation_ == generation && num_queued_ == 0)
+                cond_waiters_.wait(lock);
+            --num_waiters_;
+        }
+    }
+
+    // Wakes up the threads in waitUntil() to check their condition
+    void notifyWaiters();
+
+    unsigned int numThreads() const { return workers_.size(); }
+
+private:
+
+    struct Worker
+    {
+        boost::mutex mutex;
+        std::deque<Task> tasks;
+    };
+
+    std::vector<Worker*> workers_;
+
+    boost::thread_group threads_;
+
+    // Protects num_queued_, stop_ and the waiter state below
+    boost::mutex mutex_wakeup_;
+
+    boost::condition_variable cond_wakeup_;
+
+    unsigned int num_queued_;
+
+    // Threads in waitUntil(), and the number of times they were notified
+    boost::condition_variable cond_waiters_;
+    unsigned int num_waiters_;
+    unsigned long generation_;
+
+    unsigned int i_next_worker_;
+
+    bool stop_;
+
+    void run(unsigned int i_worker);
+
+    bool popTask(int i_worker, Task& task);
+
+    // Index of the worker the calling thread belongs to, or -1 if it is not a worker of this pool
+    int currentWorker() const;
+
+};
+
+// ----------------------------------------------------------------------------------------------------
+//
+// Group of tasks that can be waited for. Waiting threads help executing queued tasks, so a task
+// running on the pool can itself split its work into a TaskGroup and wait for it.
+//
+// ----------------------------------------------------------------------------------------------------
+
+class TaskGroup
+{
+
+public:
+
+    TaskGroup(ThreadPool& pool) : pool_(pool), num_pending_(0) {}
+
+    ~TaskGroup() { wait(); }
+
+    void run(const Task& task);
+
+    // Blocks until all tasks in this group are finished
+    void wait();
+
+    bool finished() const;
+
+private:
+
+    ThreadPool& pool_;
+
+    mutable boost::mutex mutex_;
+
+    unsigned int num_pending_;
+
+    void execute(const Task& task);
+
+};
+
+} // end namespace sim
+
+#endif
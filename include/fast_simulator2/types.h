@@ -1,6 +1,8 @@
 #ifndef FAST_SIMULATOR2_TYPES_H_
 #define FAST_SIMULATOR2_TYPES_H_
 
+#include "fast_simulator2/id_table.h"
+
 #include <string>
 #include <boost/shared_ptr.hpp>
 #include <boost/make_shared.hpp>
@@ -19,9 +21,9 @@ typedef std::string UUId;
 //typedef boost::shared_ptr<Robot> RobotPtr;
 //typedef boost::shared_ptr<const Robot> RobotConstPtr;
 
-//class World;
-//typedef boost::shared_ptr<World> WorldPtr;
-//typedef boost::shared_ptr<const World> WorldConstPtr;
+class World;
+typedef boost::shared_ptr<World> WorldPtr;
+typedef boost::shared_ptr<const World> WorldConstPtr;
 
 //class UpdateRequest;
 //typedef boost::shared_ptr<UpdateRequest> UpdateRequestPtr;
@@ -35,15 +37,31 @@ class PluginContainer;
 typedef boost::shared_ptr<PluginContainer> PluginContainerPtr;
 typedef boost::shared_ptr<const PluginContainer> PluginContainerConstPtr;
 
+class ThreadPool;
+
+// Entity ID plus its key in the process-wide ID table (see id_table.h), which is filled in on
+// construction. Lookups of an LUId (see World::findEntityIdx()) and comparisons between LUIds use the
+// key, so they do not hash or compare strings.
 struct LUId
 {
-    LUId(const UUId& id_ = "", int index_ = -1) : id(id_), index(index_) {}
+    LUId(const UUId& id_ = "") : id(id_), index(id_.empty() ? -1 : internId(id_)) {}
+
+    // The same ID always has the same key, so comparing keys is equivalent to comparing IDs. Only the
+    // empty ID has no key, and it sorts first either way.
+    inline bool operator<(const LUId& other) const
+    {
+        return (index >= 0 && other.index >= 0) ? index < other.index : id < other.id;
+    }
 
-    inline bool operator<(const LUId& other) const { return id < other.id; }
-    inline bool operator==(const LUId& other) const { return id == other.id; }
+    inline bool operator==(const LUId& other) const
+    {
+        return (index >= 0 && other.index >= 0) ? index == other.index : id == other.id;
+    }
 
     UUId id;
-    mutable int index;
+
+    // Key of the ID (-1 for the empty ID)
+    int index;
 };
 
 struct Transform
@@ -51,21 +69,17 @@ struct Transform
     Transform() {}
 
     Transform(const LUId& parent_, const LUId& child_, const geo::Pose3D& pose_)
-        : parent(parent_), child(child_), pose(pose_)
+        : parent(parent_), child(child_), pose(pose_) {}
+
+    // A transform is identified by the parent and child it connects
+    inline bool operator<(const Transform& other) const
     {
-        // TODO: better id generation
-        id_ = parent.id + "-" + child.id;
+        return parent == other.parent ? child < other.child : parent < other.parent;
     }
 
-    const UUId& id() const { return id_; }
-
     LUId parent;
     LUId child;
     geo::Pose3D pose;
-
-private:
-
-    UUId id_;
 };
 typedef boost::shared_ptr<Transform> TransformPtr;
 typedef boost::shared_ptr<const Transform> TransformConstPtr;
@@ -0,0 +1,238 @@
+#ifndef FAST_SIMULATOR2_WORLD_H_
+#define FAST_SIMULATOR2_WORLD_H_
+
+#include "fast_simulator2/types.h"
+#include "fast_simulator2/persistent_vector.h"
+#include "fast_simulator2/spatial_index.h"
+#include "fast_simulator2/static_geometry.h"
+
+#include <ed/types.h>
+
+#include <boost/thread/locks.hpp>
+#include <boost/thread/mutex.hpp>
+
+#include <map>
+#include <vector>
+
+namespace sim
+{
+
+// ----------------------------------------------------------------------------------------------------
+//
+// Snapshot of the simulated world. All data is stored in persistent vectors, so copying a World is
+// O(1) and update() only clones the entities, relations and index nodes it actually touches. This
+// makes it cheap to create a new snapshot every simulation step while plugins are still reading
+// older ones: once a World is handed out as WorldConstPtr it is never modified again.
+//
+// Each entity has at most one parent relation, i.e., the entities form a forest rooted at 'world'.
+//
+// ----------------------------------------------------------------------------------------------------
+
+class World
+{
+
+public:
+
+    class const_iterator : public std::iterator<std::forward_iterator_tag, ed::EntityConstPtr>
+    {
+
+    public:
+
+        const_iterator(const PersistentVector<ed::EntityConstPtr>::const_iterator& it,
+                       const PersistentVector<ed::EntityConstPtr>::const_iterator& end) : it_(it), end_(end)
+        {
+            skipEmpty();
+        }
+
+        const ed::EntityConstPtr& operator*() const { return *it_; }
+
+        const ed::EntityConstPtr* operator->() const { return &(*it_); }
+
+        const_iterator& operator++() { ++it_; skipEmpty(); return *this; }
+
+        bool operator==(const const_iterator& other) const { return it_ == other.it_; }
+
+        bool operator!=(const const_iterator& other) const { return it_ != other.it_; }
+
+        // Index of the entity this iterator points to
+        int index() const { return it_.index(); }
+
+    private:
+
+        PersistentVector<ed::EntityConstPtr>::const_iterator it_, end_;
+
+        void skipEmpty() { while(it_ != end_ && !*it_) ++it_; }
+
+    };
+
+    World();
+
+    void update(const ed::UpdateRequest& req);
+
+    const_iterator begin() const { return const_iterator(entities_.begin(), entities_.end()); }
+
+    const_iterator end() const { return const_iterator(entities_.end(), entities_.end()); }
+
+    ed::EntityConstPtr getEntity(const UUId& id) const;
+
+    ed::EntityConstPtr getEntity(const LUId& id) const;
+
+    bool findEntityIdx(const UUId& id, int& idx) const;
+
+    // O(1) lookup by the interned key of the ID, without hashing or comparing strings
+    bool findEntityIdx(const LUId& id, int& idx) const;
+
+    // Returns the entity at index 'idx'. Can be empty if the entity was removed.
+    const ed::EntityConstPtr& entity(int idx) const { return entities_[idx]; }
+
+    // Calculates the pose of 'target' expressed in the frame of 'source'
+    bool calculateTransform(const UUId& source, const UUId& target, double time, geo::Pose3D& tf) const;
+
+    // Pose of the entity in the frame of 'world'. Returns false if the entity is not connected to
+    // 'world'. O(1) if the poses were prepared for this time (see preparePoses()), otherwise the
+    // relations up to the root are walked: O(depth).
+    bool worldPose(int idx, double time, geo::Pose3D& pose) const;
+
+    bool worldPose(const UUId& id, double time, geo::Pose3D& pose) const;
+
+    bool worldPose(const LUId& id, double time, geo::Pose3D& pose) const;
+
+    // Calculates the poses of all entities at the given time in one pass over the trees, so that the
+    // pose queries at that time are O(1). Thread-safe; does nothing if they were already prepared.
+    // The simulator prepares the poses once for the time at which it hands out the snapshot. If a
+    // pool is given, large worlds are split over the subtrees below the roots, calculated in parallel.
+    void preparePoses(double time, ThreadPool* pool = 0) const;
+
+    // Index of the world-frame bounding boxes of all entities that have a shape
+    const SpatialIndex& spatialIndex() const { return spatial_index_; }
+
+    // World-frame meshes of the entities that are static: entities that are marked static (see
+    // markStatic()), and entities of which the shape and pose have not changed during the last
+    // STATIC_AGE updates. An entity that changes is removed from the static geometry again.
+    const StaticGeometry& staticGeometry() const { return static_geometry_; }
+
+    // Marks the entities as static right away, instead of waiting until they have not moved for
+    // STATIC_AGE updates. May only be called before the snapshot is handed out.
+    void markStatic(const std::vector<UUId>& ids);
+
+    // Number of updates an entity must stay unchanged before it is considered static
+    static const unsigned long STATIC_AGE = 100;
+
+    unsigned int numEntities() const { return num_entities_; }
+
+    // Upper bound (exclusive) on entity indices
+    unsigned int entityCapacity() const { return entities_.size(); }
+
+    unsigned long revision() const { return revision_; }
+
+private:
+
+    struct RelationEntry
+    {
+        RelationEntry() : parent(-1), child(-1) {}
+        int parent;
+        int child;
+        ed::RelationConstPtr relation;
+    };
+
+    typedef boost::shared_ptr<const std::vector<int> > IndexListConstPtr;
+
+    unsigned long revision_;
+
+    unsigned int num_entities_;
+
+    // Entity index -> entity. Indices are assigned when an entity is created. Removed entities leave
+    // an empty slot; indices are never reused (an entity that is added again gets a new index).
+    PersistentVector<ed::EntityConstPtr> entities_;
+
+    // Entity index -> index of the relation to its parent (-1 if no parent)
+    PersistentVector<int> parent_relations_;
+
+    // Entity index -> indices of the relations to its children
+    PersistentVector<IndexListConstPtr> child_relations_;
+
+    PersistentVector<RelationEntry> relations_;
+
+    // Entity index -> bounding box of its shape in the entity frame
+    PersistentVector<BoundingBox> local_bounds_;
+
+    SpatialIndex spatial_index_;
+
+    // Entity index -> revision from which the entity is static if it does not change
+    PersistentVector<unsigned long> static_since_;
+
+    StaticGeometry static_geometry_;
+
+    // Revision at which the next entity may become static
+    unsigned long next_static_check_;
+
+    // Interned ID key (see id_table.h) -> entity index (-1 if there is no entity with that ID). Only
+    // covers the keys up to the highest key of an entity that was ever added.
+    PersistentVector<int> entity_idx_by_key_;
+
+    int getOrAddEntity(const UUId& id, std::map<int, ed::EntityPtr>& new_entities);
+
+    ed::EntityPtr mutableEntity(int idx, std::map<int, ed::EntityPtr>& new_entities);
+
+    void setRelation(int parent, int child, const ed::RelationConstPtr& r);
+
+    void removeChildRelation(int parent, int r_idx);
+
+    void removeEntity(int idx);
+
+    void updateStaticGeometry();
+
+    // Poses of all entities in the frame of the root of their tree, at the given time
+    struct PoseTable
+    {
+        double time;
+
+        // Entity index -> pose in the root frame
+        std::vector<geo::Pose3D> poses;
+
+        // Entity index -> root (-1 if the pose could not be calculated)
+        std::vector<int> roots;
+
+        // Index of 'world' (-1 if it does not exist)
+        int world_idx;
+    };
+
+    typedef boost::shared_ptr<const PoseTable> PoseTableConstPtr;
+
+    // Pose tables of the most recently prepared times (plugins that are started in different steps
+    // can process the same snapshot at different times). Shared by copies of the snapshot (which have
+    // the same poses) and replaced by update().
+    struct PoseCache
+    {
+        PoseCache() : next(0) {}
+
+        boost::mutex mutex;
+        PoseTableConstPtr tables[4];
+
+        // Slot that is replaced next
+        unsigned int next;
+    };
+
+    boost::shared_ptr<PoseCache> pose_cache_;
+
+    // Returns the pose table for the given time, or an empty pointer if it was not prepared
+    PoseTableConstPtr findPoseTable(double time) const;
+
+    void calculatePoses(PoseTable& table, ThreadPool* pool) const;
+
+    // Calculates the poses in the subtrees of which the top entities (starts[i_begin] up to
+    // starts[i_end]) already have a pose
+    void calculateSubtreePoses(PoseTable* table, const std::vector<int>* starts, int i_begin, int i_end) const;
+
+    // Walks the relations from the entity up to the root of its tree: O(depth)
+    bool poseInRoot(int idx, double time, geo::Pose3D& pose, int& root) const;
+
+    void insertId(const UUId& id, int idx);
+
+    void eraseId(const UUId& id);
+
+};
+
+} // end namespace sim
+
+#endif
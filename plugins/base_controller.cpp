@@ -1,6 +1,6 @@
 #include "base_controller.h"
 
-#include <ed/world_model.h>
+#include "fast_simulator2/world.h"
 #include <ed/uuid.h>
 
 #include <ros/time.h>
@@ -75,13 +75,13 @@ void BaseController::configure(tue::Configuration config, const sim::LUId& obj_i
 
 // ----------------------------------------------------------------------------------------------------
 
-void BaseController::process(const ed::WorldModel& world, const sim::LUId& obj_id, double dt, ed::UpdateRequest& req)
+void BaseController::process(const sim::World& world, const sim::LUId& obj_id, double time, double dt, ed::UpdateRequest& req)
 {
-    // Get ROS current time
-    ros::Time time = ros::Time::now();
+    // Stamp with the simulated time
+    ros::Time stamp(time);
 
     geo::Pose3D base_pose;
-    if (!world.calculateTransform("world", ed::UUID(obj_id.id), time.toSec(), base_pose))
+    if (!world.worldPose(obj_id, time, base_pose))
     {
         std::cout << "[FAST SIMULATOR 2] Could not get robot base pose" << std::endl;
         return;
@@ -98,7 +98,7 @@ void BaseController::process(const ed::WorldModel& world, const sim::LUId& obj_i
     tf::StampedTransform tf_odom;
     tf_odom.frame_id_ = "/amigo/odom";
     tf_odom.child_frame_id_ = "/amigo/base_link";
-    tf_odom.stamp_ = time;
+    tf_odom.stamp_ = stamp;
 
     geo::convert(base_pose, tf_odom);
     tf_broadcaster_->sendTransform(tf_odom);
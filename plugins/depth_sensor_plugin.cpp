@@ -3,51 +3,170 @@
 #include <geolib/Shape.h>
 
 #include <opencv2/highgui/highgui.hpp>
+#include <opencv2/imgproc/imgproc.hpp>
 
 #include <rgbd/Image.h>
 #include <rgbd/serialization.h>
 #include <rgbd/RGBDMsg.h>
-#include <tue/serialization/conversions.h>
+#include <tue/serialization/archive.h>
 
 // ROS
 #include <rgbd/ros/conversions.h>
 #include <sensor_msgs/Image.h>
 #include <sensor_msgs/CameraInfo.h>
+#include <sensor_msgs/CompressedImage.h>
+#include <sensor_msgs/PointCloud2.h>
 #include <ros/node_handle.h>
 
-#include <ed/world_model.h>
+#include "fast_simulator2/world.h"
+#include "fast_simulator2/thread_pool.h"
+#include "fast_simulator2/depth_buffer.h"
+#include "fast_simulator2/depth_codec.h"
+#include "fast_simulator2/point_cloud.h"
 #include <ed/uuid.h>
 #include <ed/entity.h>
 
-// ----------------------------------------------------------------------------------------------------
+#include <tue/profiling/timer.h>
 
-class DepthSensorRenderResult : public geo::RenderResult {
+#include <boost/bind.hpp>
 
-public:
+#include <algorithm>
+#include <cstring>
+#include <streambuf>
 
-    DepthSensorRenderResult(cv::Mat& z_buffer, int width, int height)
-                : geo::RenderResult(width, height), z_buffer_(z_buffer)
-    {
-    }
+namespace
+{
 
-    void renderPixel(int x, int y, float depth, int i_triangle)
+sim::DepthBuffer toDepthBuffer(cv::Mat& image, cv::Mat* labels = 0)
+{
+    // The label image (CV_32SC1) has the same layout as the depth image
+    return sim::DepthBuffer(image.ptr<float>(0), labels ? labels->ptr<int>(0) : 0, image.cols, image.rows,
+                            image.step / sizeof(float));
+}
+
+// Color of entities for which no color is configured: based on the type, so all entities of the same
+// type get the same color
+cv::Vec3b typeColor(const std::string& type)
+{
+    // FNV-1a
+    unsigned int h = 2166136261u;
+    for(unsigned int i = 0; i < type.size(); ++i)
+        h = (h ^ (unsigned char)type[i]) * 16777619u;
+
+    // Avoid very dark and very bright colors (the background is white)
+    return cv::Vec3b(40 + (h & 0xff) * 160 / 255, 40 + ((h >> 8) & 0xff) * 160 / 255, 40 + ((h >> 16) & 0xff) * 160 / 255);
+}
+
+// Copies the image into the message. Reuses the memory the message already has.
+void toImageMsg(const cv::Mat& image, const std::string& encoding, sensor_msgs::Image& msg)
+{
+    msg.height = image.rows;
+    msg.width = image.cols;
+    msg.encoding = encoding;
+    msg.is_bigendian = 0;
+    msg.step = image.cols * image.elemSize();
+    msg.data.resize(msg.step * image.rows);
+
+    for(int y = 0; y < image.rows; ++y)
+        memcpy(&msg.data[y * msg.step], image.ptr(y), msg.step);
+}
+
+// Clears the pixels (and labels) of which the depth exceeds 'max_range' (if > 0). Entities that are
+// partly within range are rendered completely, so they have to be cut off.
+void clipRange(cv::Mat& depth_image, cv::Mat* label_image, float max_range)
+{
+    if (max_range <= 0)
+        return;
+
+    for(int y = 0; y < depth_image.rows; ++y)
     {
-        float old_depth = z_buffer_.at<float>(y, x);
-        if (old_depth == 0 || depth < old_depth)
+        float* depths = depth_image.ptr<float>(y);
+        int* labels = label_image ? label_image->ptr<int>(y) : 0;
+        for(int x = 0; x < depth_image.cols; ++x)
         {
-            z_buffer_.at<float>(y, x) = depth;
+            if (depths[x] > max_range)
+            {
+                depths[x] = 0;
+                if (labels)
+                    labels[x] = 0;
+            }
         }
     }
+}
+
+void runTask(const sim::Task& task)
+{
+    task();
+}
+
+template<typename MsgPtr>
+void publishMsg(const ros::Publisher& pub, const MsgPtr& msg)
+{
+    pub.publish(msg);
+}
+
+bool parseRGBStorage(const std::string& s, rgbd::RGBStorageType& type)
+{
+    if (s == "jpg")
+        type = rgbd::RGB_STORAGE_JPG;
+    else if (s == "lossless" || s == "raw")
+        type = rgbd::RGB_STORAGE_LOSSLESS;
+    else if (s == "none")
+        type = rgbd::RGB_STORAGE_NONE;
+    else
+        return false;
+    return true;
+}
+
+bool parseDepthStorage(const std::string& s, rgbd::DepthStorageType& type)
+{
+    if (s == "png")
+        type = rgbd::DEPTH_STORAGE_PNG;
+    else if (s == "lossless" || s == "raw")
+        type = rgbd::DEPTH_STORAGE_LOSSLESS;
+    else if (s == "none")
+        type = rgbd::DEPTH_STORAGE_NONE;
+    else
+        return false;
+    return true;
+}
+
+// Stream buffer that appends to a byte vector (keeping its capacity between frames)
+class VectorStreamBuf : public std::streambuf
+{
+
+public:
+
+    VectorStreamBuf(std::vector<uint8_t>& data) : data_(data) {}
 
 protected:
 
-    cv::Mat& z_buffer_;
+    int_type overflow(int_type c)
+    {
+        if (c != traits_type::eof())
+            data_.push_back(c);
+        return c;
+    }
+
+    std::streamsize xsputn(const char* s, std::streamsize n)
+    {
+        data_.insert(data_.end(), s, s + n);
+        return n;
+    }
+
+private:
+
+    std::vector<uint8_t>& data_;
 
 };
 
+}
+
 // ----------------------------------------------------------------------------------------------------
 
-DepthSensorPlugin::DepthSensorPlugin() : render_rgb_(false), render_depth_(false)
+DepthSensorPlugin::DepthSensorPlugin() : render_rgb_(false), render_depth_(false), max_range_(0), render_view_(-1),
+    adaptive_resolution_(false), max_render_scale_(1), render_scale_(1), frame_budget_(0), num_over_budget_(0),
+    num_under_budget_(0), num_dropped_(0)
 {
 }
 
@@ -74,15 +193,78 @@ void DepthSensorPlugin::configure(tue::Configuration config, const sim::LUId& ob
         config.value("fx", fx);
         config.value("fy", fy);
 
+        // Depths beyond the maximum range are not measured (0). Also limits the entities that are
+        // considered for rendering to those within range.
+        config.value("max_range", max_range_, tue::OPTIONAL);
+
         depth_rasterizer_.setOpticalTranslation(0, 0);
         depth_rasterizer_.setOpticalCenter(((double)depth_width_ + 1) / 2, ((double)depth_height_ + 1) / 2);
         depth_rasterizer_.setFocalLengths(fx, fy);
 
+        // Used for culling entities outside the field of view. The optical center is (nearly) in
+        // the middle of the image, so the frustum is symmetric.
+        double tan_x = depth_rasterizer_.getOpticalCenterX() / fx;
+        double tan_y = depth_rasterizer_.getOpticalCenterY() / fy;
+        frustum_ = sim::Frustum::camera(tan_x, tan_x, tan_y, tan_y, 0, max_range_);
+
+        render_view_ = addRenderView(depth_rasterizer_, frustum_);
+
+        // Adaptive resolution: when processing takes longer than the frame budget, render at half or
+        // quarter resolution until there is enough headroom again. The published images keep their
+        // configured size (width x height): they are upsampled (nearest neighbour) from the lower
+        // resolution, and only the diagnostics show the render scale. Since the resolution then depends
+        // on the load of the host, simulation runs with adaptive resolution are not reproducible.
+        int adaptive_resolution = 0;
+        if (config.value("adaptive_resolution", adaptive_resolution, tue::OPTIONAL))
+            adaptive_resolution_ = adaptive_resolution;
+
+        max_render_scale_ = 4;
+        config.value("max_scale", max_render_scale_, tue::OPTIONAL);
+        if (max_render_scale_ != 1 && max_render_scale_ != 2 && max_render_scale_ != 4)
+            config.addError("max_scale must be 1, 2 or 4.");
+
+        // Seconds of wall-clock time per frame. Must be given explicitly: the time step between cycles is
+        // simulated time, which is unrelated to the processing time if the simulator does not run in
+        // real time (e.g. in lockstep mode).
+        config.value("frame_budget", frame_budget_, tue::OPTIONAL);
+        if (adaptive_resolution_ && frame_budget_ <= 0)
+            config.addError("adaptive_resolution requires a positive frame_budget (wall-clock seconds per frame).");
+
+        if (adaptive_resolution_)
+        {
+            setDiagnostic("render scale", render_scale_);
+            setDiagnostic("render width", depth_width_);
+            setDiagnostic("render height", depth_height_);
+        }
+
         render_depth_ = true;
 
         config.endGroup();
     }
 
+    // Entity colors in the rgb image, by entity id or type (bgr, 0 - 255)
+    if (config.readArray("colors"))
+    {
+        while(config.nextArrayItem())
+        {
+            int r = 0, g = 0, b = 0;
+            config.value("r", r);
+            config.value("g", g);
+            config.value("b", b);
+            cv::Vec3b color(b, g, r);
+
+            std::string id, type;
+            if (config.value("id", id, tue::OPTIONAL))
+                colors_by_id_[id] = color;
+            else if (config.value("type", type, tue::OPTIONAL))
+                colors_by_type_[type] = color;
+            else
+                config.addError("Color must have an 'id' or 'type'.");
+        }
+
+        config.endArray();
+    }
+
     if (!ros::isInitialized())
          ros::init(ros::M_string(), "simulator", ros::init_options::NoSigintHandler);
 
@@ -94,8 +276,45 @@ void DepthSensorPlugin::configure(tue::Configuration config, const sim::LUId& ob
         {
             std::string rgbd_topic;
             if (config.value("rgbd", rgbd_topic, tue::OPTIONAL))
+            {
                 pubs_rgbd_.push_back(nh.advertise<rgbd::RGBDMsg>(rgbd_topic, 10));
 
+                // Storage (compression) can be set per topic. On localhost, 'lossless' (raw) is
+                // usually cheaper than compressing.
+                RGBDStorage storage;
+                std::string rgb_storage = "jpg", depth_storage = "png";
+                config.value("rgb_storage", rgb_storage, tue::OPTIONAL);
+                config.value("depth_storage", depth_storage, tue::OPTIONAL);
+
+                if (!parseRGBStorage(rgb_storage, storage.rgb))
+                    config.addError("Unknown rgb_storage '" + rgb_storage + "' (use 'jpg', 'lossless' or 'none').");
+                if (!parseDepthStorage(depth_storage, storage.depth))
+                    config.addError("Unknown depth_storage '" + depth_storage + "' (use 'png', 'lossless' or 'none').");
+
+                rgbd_storage_.push_back(storage);
+            }
+
+            // Depth compressed with the fast lossless codec of the simulator (see depth_codec.h)
+            std::string depth_compressed_topic;
+            if (config.value("depth_compressed", depth_compressed_topic, tue::OPTIONAL))
+                pubs_depth_compressed_.push_back(nh.advertise<sensor_msgs::CompressedImage>(depth_compressed_topic, 10));
+
+            // Depth images in a shared memory ring, for consumers on the same machine
+            std::string depth_shm_name;
+            if (config.value("depth_shm", depth_shm_name, tue::OPTIONAL))
+            {
+                int num_slots = 4;
+                config.value("slots", num_slots, tue::OPTIONAL);
+
+                std::string error;
+                depth_ring_.reset(new sim::SharedImageRing);
+                if (!render_depth_)
+                    config.addError("depth_shm requires the 'depth' group.");
+                else if (!depth_ring_->create(depth_shm_name, depth_width_, depth_height_, sizeof(float), "32FC1",
+                                              num_slots, error))
+                    config.addError(error);
+            }
+
             std::string depth_topic;
             if (config.value("depth", depth_topic, tue::OPTIONAL))
                 pubs_depth_.push_back(nh.advertise<sensor_msgs::Image>(depth_topic, 10));
@@ -108,9 +327,19 @@ void DepthSensorPlugin::configure(tue::Configuration config, const sim::LUId& ob
             if (config.value("rgb", rgb_topic, tue::OPTIONAL))
                 pubs_rgb_.push_back(nh.advertise<sensor_msgs::Image>(rgb_topic, 10));
 
+            // Instance ID per pixel (32SC1): world index of the entity + 1, 0 if there is no entity
+            std::string instance_topic;
+            if (config.value("instance", instance_topic, tue::OPTIONAL))
+                pubs_instance_.push_back(nh.advertise<sensor_msgs::Image>(instance_topic, 10));
+
             std::string rgb_info_topic;
             if (config.value("rgb_info", rgb_info_topic, tue::OPTIONAL))
                 pubs_cam_info_rgb_.push_back(nh.advertise<sensor_msgs::CameraInfo>(rgb_info_topic, 10));
+
+            // Organized point cloud (x, y, z) in the depth camera frame
+            std::string points_topic;
+            if (config.value("points", points_topic, tue::OPTIONAL))
+                pubs_points_.push_back(nh.advertise<sensor_msgs::PointCloud2>(points_topic, 10));
         }
 
         config.endArray();
@@ -118,131 +347,486 @@ void DepthSensorPlugin::configure(tue::Configuration config, const sim::LUId& ob
 
     config.value("frame_id", rgb_frame_id_);
     depth_frame_id_ = rgb_frame_id_;
+
+    // Number of frames that can wait for the encoder. If the encoder cannot keep up, the oldest
+    // frames are dropped.
+    int encode_queue_size = 1;
+    config.value("encode_queue_size", encode_queue_size, tue::OPTIONAL);
+
+    // A frame buffer is in use while it is rendered into, encoded, or waiting for the encoder. The
+    // encoded messages are in use until the publish stage has sent them.
+    unsigned int num_in_flight = std::max(1, encode_queue_size) + 2;
+    depth_frames_.setCapacity(num_in_flight);
+    rgb_frames_.setCapacity(num_in_flight);
+    rgbd_msgs_.setCapacity(num_in_flight * std::max<unsigned int>(1, pubs_rgbd_.size()));
+    compressed_depth_msgs_.setCapacity(num_in_flight);
+
+    encode_stage_.reset(new sim::PipelineStage<EncodeFrame>(
+                            threadPool(), boost::bind(&DepthSensorPlugin::encode, this, _1), encode_queue_size));
+
+    // One publish task per encoded output, so make room for all outputs of the queued frames
+    unsigned int num_encoded_outputs = std::max<unsigned int>(1, pubs_rgbd_.size() + pubs_depth_compressed_.size());
+    publish_stage_.reset(new sim::PipelineStage<sim::Task>(threadPool(), &runTask,
+                                                           encode_queue_size * num_encoded_outputs));
+
+    rgbd::convert(depth_rasterizer_, cam_info_);
 }
 
 // ----------------------------------------------------------------------------------------------------
 
-void DepthSensorPlugin::process(const ed::WorldModel& world, const sim::LUId& obj_id, double dt, ed::UpdateRequest& req)
+void DepthSensorPlugin::process(const sim::World& world, const sim::LUId& obj_id, double time, double dt, ed::UpdateRequest& req)
 {
-    // Get ROS current time
-    ros::Time time = ros::Time::now();
+    // Only produce the outputs somebody consumes. Checked every cycle, so rendering resumes as soon
+    // as a subscriber appears.
+    bool publish_depth = demanded(pubs_depth_);
+    bool publish_rgb = demanded(pubs_rgb_);
+    bool publish_cam_info_depth = demanded(pubs_cam_info_depth_);
+    bool publish_cam_info_rgb = demanded(pubs_cam_info_rgb_);
+    bool publish_rgbd = demanded(pubs_rgbd_);
+    bool publish_depth_compressed = demanded(pubs_depth_compressed_);
+    bool publish_depth_shm = depth_ring_ && depth_ring_->isOpen() && depth_ring_->hasReaders();
+    bool publish_instance = demanded(pubs_instance_);
+    bool publish_points = render_depth_ && demanded(pubs_points_);
+
+    if (!publish_depth && !publish_rgb && !publish_cam_info_depth && !publish_cam_info_rgb && !publish_rgbd
+            && !publish_depth_compressed && !publish_depth_shm && !publish_instance && !publish_points)
+        return;
+
+    bool publish_encoded = publish_rgbd || publish_depth_compressed;
+    bool render_rgb = render_rgb_ && (publish_rgb || publish_rgbd);
+
+    // The rasterizer writes the instance ID of each pixel together with its depth. The rgb image is
+    // colored based on these IDs afterwards, so it does not need a separate pass over the geometry.
+    bool render_labels = render_depth_ && (render_rgb || publish_instance);
+
+    bool render_depth = render_depth_ && (publish_depth || publish_encoded || publish_depth_shm || publish_points
+                                          || render_labels);
+
+    tue::Timer timer;
+    timer.start();
+
+    // Stamp with the simulated time
+    ros::Time stamp(time);
 
     geo::Pose3D camera_pose;
-    if (!world.calculateTransform("world", obj_id.id, time.toSec(), camera_pose))
+    if (!world.worldPose(obj_id, time, camera_pose))
         return;
 
+    // Frame buffers are taken from pools: a buffer is only reused when nobody refers to it anymore
+    // (e.g., when the encoder has finished with it)
+    EncodeFrame frame;
+    frame.time = time;
+
     cv::Mat depth_image;
     cv::Mat rgb_image;
 
-    if (render_rgb_)
+    if (render_rgb)
     {
-        rgb_image = cv::Mat(rgb_height_, rgb_width_, CV_8UC3, cv::Scalar(255, 255, 255));
+        sim::ObjectPool<cv::Mat>::Ptr& rgb_frame = frame.rgb;
+        if (!acquire(rgb_frames_, rgb_frame))
+            return;
+
+        rgb_frame->create(rgb_height_, rgb_width_, CV_8UC3);
+        rgb_image = *rgb_frame;
+
+        // Without a depth camera there is nothing to color
+        if (!render_labels)
+            rgb_image.setTo(cv::Scalar(255, 255, 255));
     }
 
-    if (render_depth_)
+    if (render_depth)
     {
-        // Calculate inverse camera pose, including correction for geolib frame
-        geo::Pose3D camera_pose_inv = geo::Pose3D(0, 0, 0, 3.1415, 0, 0) * camera_pose.inverse();
+        if (publish_depth_shm)
+        {
+            // Render directly into the shared memory
+            depth_image = cv::Mat(depth_height_, depth_width_, CV_32FC1, depth_ring_->beginWrite(), depth_ring_->step());
+        }
+        else
+        {
+            if (!acquire(depth_frames_, frame.depth))
+                return;
+
+            frame.depth->create(depth_height_, depth_width_, CV_32FC1);
+            depth_image = *frame.depth;
+        }
 
-        depth_image = cv::Mat(depth_height_, depth_width_, CV_32FC1, 0.0);
+        depth_image.setTo(0);
 
-        DepthSensorRenderResult res(depth_image, depth_width_, depth_height_);
+        cv::Mat* label_image = 0;
+        if (render_labels)
+        {
+            label_image_.create(depth_height_, depth_width_, CV_32SC1);
+            label_image_.setTo(0);
+            label_image = &label_image_;
+        }
 
-        for(ed::WorldModel::const_iterator it = world.begin(); it != world.end(); ++it)
+        // Rendered together with the other cameras that are due in this step. Only the entities of
+        // which the bounding box is within the field of view are rendered.
+        if (render_scale_ == 1)
         {
-            const ed::EntityConstPtr& e = *it;
+            renderService().render(render_view_, world, camera_pose, toDepthBuffer(depth_image, label_image),
+                                   &visible_entities_);
+            clipRange(depth_image, label_image, max_range_);
+        }
+        else
+        {
+            // Render at reduced resolution and upsample. Nearest neighbour, so that depths and labels
+            // are not blended across object boundaries.
+            depth_small_.create(depth_height_ / render_scale_, depth_width_ / render_scale_, CV_32FC1);
+            depth_small_.setTo(0);
 
-            if (e->shape())
+            cv::Mat* label_small = 0;
+            if (render_labels)
             {
-                // Correction for geolib frame
-                geo::Pose3D rel_pose = camera_pose_inv * e->pose();
+                label_small_.create(depth_small_.rows, depth_small_.cols, CV_32SC1);
+                label_small_.setTo(0);
+                label_small = &label_small_;
+            }
+
+            renderService().render(render_view_, world, camera_pose, toDepthBuffer(depth_small_, label_small),
+                                   &visible_entities_);
+            clipRange(depth_small_, label_small, max_range_);
+
+            cv::resize(depth_small_, depth_image, depth_image.size(), 0, 0, cv::INTER_NEAREST);
+            if (render_labels)
+                cv::resize(label_small_, label_image_, label_image_.size(), 0, 0, cv::INTER_NEAREST);
+        }
 
-                // Set render options
-                geo::RenderOptions opt;
-                opt.setMesh(e->shape()->getMesh(), rel_pose);
+        if (render_rgb)
+            colorImage(world, rgb_image);
 
-                // Render
-                depth_rasterizer_.render(opt, res);
+        if (publish_depth_shm)
+        {
+            depth_ring_->commit(time);
+
+            // The slot will be overwritten by later frames, so the encode stage needs its own copy
+            if (publish_encoded)
+            {
+                if (acquire(depth_frames_, frame.depth))
+                    depth_image.copyTo(*frame.depth);
+                else
+                    publish_encoded = false;
             }
         }
     }
 
-    if (!pubs_depth_.empty())
+    sensor_msgs::ImagePtr depth_image_msg;
+    if (publish_depth && acquire(depth_msgs_, depth_image_msg))
     {
         // Convert depth image to ROS message
-        sensor_msgs::Image depth_image_msg;
-        rgbd::convert(depth_image, depth_image_msg);
-        depth_image_msg.header.stamp = time;
-        depth_image_msg.header.frame_id = depth_frame_id_;
+        toImageMsg(depth_image, "32FC1", *depth_image_msg);
+        depth_image_msg->header.stamp = stamp;
+        depth_image_msg->header.frame_id = depth_frame_id_;
 
         // Publish image
         for(std::vector<ros::Publisher>::const_iterator it = pubs_depth_.begin(); it != pubs_depth_.end(); ++it)
             it->publish(depth_image_msg);
     }
 
-    if (!pubs_cam_info_depth_.empty())
+    sensor_msgs::PointCloud2Ptr points_msg;
+    if (publish_points && acquire(points_msgs_, points_msg))
+    {
+        // Converted once, and the same message is sent to all consumers
+        toPointCloudMsg(depth_image, *points_msg);
+        points_msg->header.stamp = stamp;
+        points_msg->header.frame_id = depth_frame_id_;
+
+        for(std::vector<ros::Publisher>::const_iterator it = pubs_points_.begin(); it != pubs_points_.end(); ++it)
+            it->publish(points_msg);
+    }
+
+    sensor_msgs::ImagePtr instance_msg;
+    if (publish_instance && acquire(instance_msgs_, instance_msg))
     {
-        // Convert camera info to ROS message
-        sensor_msgs::CameraInfo cam_info_depth;
-        rgbd::convert(depth_rasterizer_, cam_info_depth);
-        cam_info_depth.header.stamp = time;
-        cam_info_depth.header.frame_id = depth_frame_id_;
+        toImageMsg(label_image_, "32SC1", *instance_msg);
+        instance_msg->header.stamp = stamp;
+        instance_msg->header.frame_id = depth_frame_id_;
+
+        for(std::vector<ros::Publisher>::const_iterator it = pubs_instance_.begin(); it != pubs_instance_.end(); ++it)
+            it->publish(instance_msg);
+    }
+
+    sensor_msgs::CameraInfoPtr cam_info_depth;
+    if (publish_cam_info_depth && acquire(cam_info_msgs_, cam_info_depth))
+    {
+        // Camera info does not change, so copy it from the one created during configuration
+        *cam_info_depth = cam_info_;
+        cam_info_depth->header.stamp = stamp;
+        cam_info_depth->header.frame_id = depth_frame_id_;
 
         // Publish camera info
         for(std::vector<ros::Publisher>::const_iterator it = pubs_cam_info_depth_.begin(); it != pubs_cam_info_depth_.end(); ++it)
             it->publish(cam_info_depth);
     }
 
-    if (!pubs_rgb_.empty())
+    sensor_msgs::ImagePtr rgb_image_msg;
+    if (publish_rgb && acquire(rgb_msgs_, rgb_image_msg))
     {
         // Convert rgb image to ROS message
-        sensor_msgs::Image rgb_image_msg;
-        rgbd::convert(rgb_image, rgb_image_msg);
-        rgb_image_msg.header.stamp = time;
-        rgb_image_msg.header.frame_id = rgb_frame_id_;
+        toImageMsg(rgb_image, "bgr8", *rgb_image_msg);
+        rgb_image_msg->header.stamp = stamp;
+        rgb_image_msg->header.frame_id = rgb_frame_id_;
 
         // Publish image
         for(std::vector<ros::Publisher>::const_iterator it = pubs_rgb_.begin(); it != pubs_rgb_.end(); ++it)
             it->publish(rgb_image_msg);
     }
 
-    if (!pubs_cam_info_rgb_.empty())
+    sensor_msgs::CameraInfoPtr cam_info_rgb;
+    if (publish_cam_info_rgb && acquire(cam_info_msgs_, cam_info_rgb))
     {
-        // Convert camera info to ROS message
-        sensor_msgs::CameraInfo cam_info_rgb;
-        rgbd::convert(depth_rasterizer_, cam_info_rgb);
-        cam_info_rgb.header.stamp = time;
-        cam_info_rgb.header.frame_id = rgb_frame_id_;
+        // Camera info does not change, so copy it from the one created during configuration
+        *cam_info_rgb = cam_info_;
+        cam_info_rgb->header.stamp = stamp;
+        cam_info_rgb->header.frame_id = rgb_frame_id_;
 
         // Publish camera info
         for(std::vector<ros::Publisher>::const_iterator it = pubs_cam_info_rgb_.begin(); it != pubs_cam_info_rgb_.end(); ++it)
             it->publish(cam_info_rgb);
     }
 
-    if (!pubs_rgbd_.empty())
+    if (publish_encoded)
     {
-        rgbd::Image image(rgb_image, depth_image, depth_rasterizer_, rgb_frame_id_, time.toSec());
+        // Compression is done by the encode stage, so we can start rendering the next frame. If the
+        // encoder is lagging behind, the oldest waiting frame is dropped.
+        encode_stage_->push(frame);
+    }
 
-        rgbd::RGBDMsg msg;
-        msg.version = 2;
+    timer.stop();
 
-        // Set RGB storage type
-        rgbd::RGBStorageType rgb_type = rgbd::RGB_STORAGE_JPG;
-        if (!rgb_image.data)
-            rgb_type = rgbd::RGB_STORAGE_NONE;
+    if (adaptive_resolution_ && render_depth)
+        adaptResolution(timer.getElapsedTimeInSec(), frame_budget_);
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+void DepthSensorPlugin::toPointCloudMsg(const cv::Mat& depth_image, sensor_msgs::PointCloud2& msg)
+{
+    // The fields only need to be set the first time a pooled message is used
+    if (msg.fields.size() != 3)
+    {
+        msg.fields.resize(3);
+        const char* names[] = { "x", "y", "z" };
+        for(unsigned int i = 0; i < 3; ++i)
+        {
+            msg.fields[i].name = names[i];
+            msg.fields[i].offset = i * sizeof(float);
+            msg.fields[i].datatype = sensor_msgs::PointField::FLOAT32;
+            msg.fields[i].count = 1;
+        }
+    }
+
+    msg.height = depth_image.rows;
+    msg.width = depth_image.cols;
+    msg.is_bigendian = 0;
+    msg.point_step = sim::POINT_STEP;
+    msg.row_step = msg.point_step * msg.width;
+    msg.is_dense = 0;  // Pixels without depth are NaN points
+    msg.data.resize(msg.row_step * msg.height);
+
+    // Rows are converted in parallel; the calling thread helps while waiting
+    int num_tasks = std::max<int>(1, std::min<int>(threadPool().numThreads(), depth_image.rows / 32));
+    int rows_per_task = (depth_image.rows + num_tasks - 1) / num_tasks;
+
+    sim::TaskGroup tasks(threadPool());
+    for(int row = 0; row < depth_image.rows; row += rows_per_task)
+        tasks.run(boost::bind(&DepthSensorPlugin::pointCloudTask, this, boost::cref(depth_image), row,
+                              std::min(row + rows_per_task, depth_image.rows), reinterpret_cast<float*>(&msg.data[0])));
+    tasks.wait();
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+void DepthSensorPlugin::pointCloudTask(const cv::Mat& depth_image, int row_begin, int row_end, float* points) const
+{
+    // Same intrinsics as the published camera info
+    sim::depthToPoints(depth_image.ptr<float>(0), depth_image.cols, depth_image.step / sizeof(float), row_begin, row_end,
+                       depth_rasterizer_.getFocalLengthX(), depth_rasterizer_.getFocalLengthY(),
+                       depth_rasterizer_.getOpticalCenterX(), depth_rasterizer_.getOpticalCenterY(), points);
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+void DepthSensorPlugin::adaptResolution(double process_time, double budget)
+{
+    int scale = render_scale_;
+
+    if (process_time > budget)
+    {
+        // Falling behind: lower the resolution if this persists for a few frames
+        num_under_budget_ = 0;
+        if (++num_over_budget_ >= NUM_FRAMES_DECREASE && scale < max_render_scale_)
+            scale *= 2;
+    }
+    else if (scale > 1 && 4 * process_time < 0.8 * budget)
+    {
+        // Rendering four times as many pixels would still fit, with some margin. Wait longer before
+        // increasing than before decreasing, to prevent oscillating.
+        num_over_budget_ = 0;
+        if (++num_under_budget_ >= NUM_FRAMES_INCREASE)
+            scale /= 2;
+    }
+    else
+    {
+        num_over_budget_ = 0;
+        num_under_budget_ = 0;
+    }
+
+    if (scale == render_scale_)
+        return;
+
+    render_scale_ = scale;
+    num_over_budget_ = 0;
+    num_under_budget_ = 0;
+
+    // Camera with the intrinsics of the reduced resolution
+    int width = depth_width_ / scale;
+    int height = depth_height_ / scale;
+
+    geo::DepthCamera camera;
+    camera.setOpticalTranslation(0, 0);
+    camera.setOpticalCenter(((double)width + 1) / 2, ((double)height + 1) / 2);
+    camera.setFocalLengths(depth_rasterizer_.getFocalLengthX() / scale, depth_rasterizer_.getFocalLengthY() / scale);
+    renderService().setViewCamera(render_view_, camera);
+
+    setDiagnostic("render scale", scale);
+    setDiagnostic("render width", width);
+    setDiagnostic("render height", height);
+}
+
+// ----------------------------------------------------------------------------------------------------
 
-        rgbd::DepthStorageType depth_type = rgbd::DEPTH_STORAGE_PNG;
+void DepthSensorPlugin::encode(const EncodeFrame& frame)
+{
+    cv::Mat rgb_image, depth_image;
+    if (frame.rgb)
+        rgb_image = *frame.rgb;
+    if (frame.depth)
+        depth_image = *frame.depth;
+
+    // - - - - - - - - - - - - - - - RGBD - - - - - - - - - - - - - - -
+
+    // The message pools and rgbd_encoded_ are only used by this stage, which never runs concurrently
+    // with itself
+    rgbd_encoded_.assign(pubs_rgbd_.size(), rgbd::RGBDMsgPtr());
+
+    for(unsigned int i = 0; i < pubs_rgbd_.size(); ++i)
+    {
+        if (!demanded(pubs_rgbd_[i]))
+            continue;
+
+        RGBDStorage storage = rgbd_storage_[i];
+        if (!rgb_image.data)
+            storage.rgb = rgbd::RGB_STORAGE_NONE;
         if (!depth_image.data)
-            depth_type = rgbd::DEPTH_STORAGE_NONE;
+            storage.depth = rgbd::DEPTH_STORAGE_NONE;
+
+        // Topics with the same storage share the message
+        for(unsigned int j = 0; j < i && !rgbd_encoded_[i]; ++j)
+        {
+            if (rgbd_encoded_[j] && rgbd_storage_[j] == rgbd_storage_[i])
+                rgbd_encoded_[i] = rgbd_encoded_[j];
+        }
+
+        if (!rgbd_encoded_[i])
+        {
+            rgbd::Image image(rgb_image, depth_image, depth_rasterizer_, rgb_frame_id_, frame.time);
+
+            rgbd::RGBDMsgPtr msg;
+            if (!acquire(rgbd_msgs_, msg))
+                continue;
+
+            msg->version = 2;
+
+            // Serialize directly into the (reused) message buffer
+            msg->rgb.clear();
+            VectorStreamBuf buffer(msg->rgb);
+            std::ostream stream(&buffer);
+            tue::serialization::OutputArchive a(stream);
+            rgbd::serialize(image, a, storage.rgb, storage.depth);
+
+            rgbd_encoded_[i] = msg;
+        }
+
+        publish_stage_->push(boost::bind(&publishMsg<rgbd::RGBDMsgPtr>, pubs_rgbd_[i], rgbd_encoded_[i]));
+    }
+
+    // - - - - - - - - - - - - - - - Compressed depth - - - - - - - - - - - - - - -
+
+    sensor_msgs::CompressedImagePtr msg;
+    if (depth_image.data && demanded(pubs_depth_compressed_) && acquire(compressed_depth_msgs_, msg))
+    {
+        msg->header.stamp = ros::Time(frame.time);
+        msg->header.frame_id = depth_frame_id_;
+        msg->format = sim::DEPTH_CODEC_FORMAT;
+        sim::encodeDepth(depth_image.ptr<float>(0), depth_image.cols, depth_image.rows,
+                         depth_image.step / sizeof(float), msg->data);
+
+        for(std::vector<ros::Publisher>::const_iterator it = pubs_depth_compressed_.begin(); it != pubs_depth_compressed_.end(); ++it)
+            publish_stage_->push(boost::bind(&publishMsg<sensor_msgs::CompressedImagePtr>, *it, msg));
+    }
+}
 
-        std::stringstream stream;
-        tue::serialization::OutputArchive a(stream);
-        rgbd::serialize(image, a, rgb_type, depth_type);
-        tue::serialization::convert(stream, msg.rgb);
+// ----------------------------------------------------------------------------------------------------
+
+void DepthSensorPlugin::colorImage(const sim::World& world, cv::Mat& rgb_image)
+{
+    // Color per label (instance ID), only filled for the entities that can be visible
+    palette_.resize(world.entityCapacity() + 1);
+    palette_[0] = cv::Vec3b(255, 255, 255);
+
+    if (has_id_color_.size() < world.entityCapacity())
+    {
+        has_id_color_.resize(world.entityCapacity(), -1);
+        id_colors_.resize(world.entityCapacity());
+    }
+
+    for(std::vector<int>::const_iterator it = visible_entities_.begin(); it != visible_entities_.end(); ++it)
+    {
+        int idx = *it;
+        const ed::EntityConstPtr& e = world.entity(idx);
+
+        if (has_id_color_[idx] < 0)
+        {
+            std::map<std::string, cv::Vec3b>::const_iterator it_color = colors_by_id_.find(e->id().str());
+            has_id_color_[idx] = (it_color != colors_by_id_.end());
+            if (has_id_color_[idx])
+                id_colors_[idx] = it_color->second;
+        }
+
+        if (has_id_color_[idx])
+        {
+            palette_[idx + 1] = id_colors_[idx];
+            continue;
+        }
+
+        // The type of an entity can change, so it is looked up every frame
+        std::map<std::string, cv::Vec3b>::const_iterator it_color = colors_by_type_.find(e->type());
+        if (it_color == colors_by_type_.end())
+            palette_[idx + 1] = typeColor(e->type());
+        else
+            palette_[idx + 1] = it_color->second;
+    }
+
+    // The rgb image may have a different resolution than the depth image
+    for(int y = 0; y < rgb_image.rows; ++y)
+    {
+        const int* labels = label_image_.ptr<int>(y * depth_height_ / rgb_image.rows);
+        cv::Vec3b* rgb = rgb_image.ptr<cv::Vec3b>(y);
 
-        for(std::vector<ros::Publisher>::const_iterator it = pubs_rgbd_.begin(); it != pubs_rgbd_.end(); ++it)
-            it->publish(msg);
+        if (rgb_image.cols == depth_width_)
+        {
+            for(int x = 0; x < rgb_image.cols; ++x)
+                rgb[x] = palette_[labels[x]];
+        }
+        else
+        {
+            for(int x = 0; x < rgb_image.cols; ++x)
+                rgb[x] = palette_[labels[x * depth_width_ / rgb_image.cols]];
+        }
     }
 }
 
+// ----------------------------------------------------------------------------------------------------
+
 SIM_REGISTER_PLUGIN(DepthSensorPlugin)
@@ -2,11 +2,29 @@
 #define SIMULATOR_DEPTH_SENSOR_PLUGIN_H_
 
 #include "fast_simulator2/plugin.h"
+#include "fast_simulator2/spatial_index.h"
+#include "fast_simulator2/object_pool.h"
+#include "fast_simulator2/pipeline.h"
+#include "fast_simulator2/shared_image_ring.h"
 
 #include <geolib/sensors/DepthCamera.h>
 
+#include <opencv2/core/core.hpp>
+
+#include <rgbd/RGBDMsg.h>
+#include <rgbd/serialization.h>
+
 // ROS
 #include <ros/publisher.h>
+#include <sensor_msgs/Image.h>
+#include <sensor_msgs/CameraInfo.h>
+#include <sensor_msgs/CompressedImage.h>
+#include <sensor_msgs/PointCloud2.h>
+
+#include <boost/atomic.hpp>
+#include <boost/scoped_ptr.hpp>
+
+#include <map>
 
 class DepthSensorPlugin : public sim::Plugin
 {
@@ -17,7 +35,7 @@ public:
 
     void configure(tue::Configuration config, const sim::LUId& obj_id);
 
-    void process(const ed::WorldModel& world, const sim::LUId& obj_id, double dt, ed::UpdateRequest& req);
+    void process(const sim::World& world, const sim::LUId& obj_id, double time, double dt, ed::UpdateRequest& req);
 
 private:
 
@@ -28,15 +46,133 @@ private:
 
     geo::DepthCamera depth_rasterizer_;
 
+    // Maximum depth that is measured (0 if unlimited)
+    double max_range_;
+
+    // View frustum of the depth camera in the sensor frame
+    sim::Frustum frustum_;
+
+    // View of the depth camera in the render service
+    int render_view_;
+
+    // Adaptive resolution: under load, the depth image (and the labels) are rendered at 1 / render_scale_
+    // of the configured resolution and upsampled. Only with an explicit frame budget (wall-clock time).
+    bool adaptive_resolution_;
+    int max_render_scale_, render_scale_;
+    double frame_budget_;
+
+    // Number of consecutive frames that were over budget / had enough headroom for a higher resolution
+    int num_over_budget_, num_under_budget_;
+
+    static const int NUM_FRAMES_DECREASE = 3;
+    static const int NUM_FRAMES_INCREASE = 30;
+
+    cv::Mat depth_small_, label_small_;
+
+    void adaptResolution(double process_time, double budget);
+
+    // Indices of the entities that were rendered (kept to prevent re-allocation every cycle)
+    std::vector<int> visible_entities_;
+
+    // Instance ID per pixel, rendered together with the depth image (see colorImage())
+    cv::Mat label_image_;
+
+    // Entity colors, from the configuration
+    std::map<std::string, cv::Vec3b> colors_by_id_, colors_by_type_;
+
+    // Entity index -> whether the entity has a color by ID (1), has none (0) or was not looked up yet
+    // (-1), and that color. Entity indices are never reused, so each ID is only looked up once.
+    std::vector<signed char> has_id_color_;
+    std::vector<cv::Vec3b> id_colors_;
+
+    // Color per instance ID (kept to prevent re-allocation every cycle)
+    std::vector<cv::Vec3b> palette_;
+
+    // Pooled frame buffers and messages, so that the images and messages are not re-allocated every
+    // frame. The pools are bounded: if the consumers lag behind and all objects are still in use, the
+    // output is dropped (see acquire()). Publishing itself (serialization, the tasks of the pipeline
+    // stages) may still allocate.
+    sim::ObjectPool<cv::Mat> depth_frames_, rgb_frames_;
+    sim::ObjectPool<sensor_msgs::Image> depth_msgs_, rgb_msgs_, instance_msgs_;
+    sim::ObjectPool<sensor_msgs::CameraInfo> cam_info_msgs_;
+    sim::ObjectPool<rgbd::RGBDMsg> rgbd_msgs_;
+    sim::ObjectPool<sensor_msgs::PointCloud2> points_msgs_;
+
+    // Number of outputs dropped because their pool was exhausted (process() and encode() run on
+    // different threads)
+    boost::atomic<unsigned long> num_dropped_;
+
+    // Takes an object from the pool. Returns false, and reports the drop in the diagnostics, if all
+    // objects of the pool are still in use.
+    template<typename T>
+    bool acquire(sim::ObjectPool<T>& pool, boost::shared_ptr<T>& obj)
+    {
+        obj = pool.acquire();
+        if (obj)
+            return true;
+
+        setDiagnostic("dropped outputs", ++num_dropped_);
+        return false;
+    }
+
+    // Filled once during configuration
+    sensor_msgs::CameraInfo cam_info_;
+
+    // Colors the rgb image based on the instance IDs in label_image_
+    void colorImage(const sim::World& world, cv::Mat& rgb_image);
+
+    // Back-projects the depth image into an organized point cloud (see point_cloud.h)
+    void toPointCloudMsg(const cv::Mat& depth_image, sensor_msgs::PointCloud2& msg);
+
+    void pointCloudTask(const cv::Mat& depth_image, int row_begin, int row_end, float* points) const;
+
     // ROS
     std::vector<ros::Publisher> pubs_rgb_;
     std::vector<ros::Publisher> pubs_depth_;
     std::vector<ros::Publisher> pubs_cam_info_rgb_;
     std::vector<ros::Publisher> pubs_cam_info_depth_;
     std::vector<ros::Publisher> pubs_rgbd_;
+    std::vector<ros::Publisher> pubs_instance_;
+    std::vector<ros::Publisher> pubs_points_;
 
     std::string rgb_frame_id_, depth_frame_id_;
 
+    std::vector<ros::Publisher> pubs_depth_compressed_;
+
+    // Shared memory ring the depth images are rendered into (only written while readers are attached)
+    boost::scoped_ptr<sim::SharedImageRing> depth_ring_;
+
+    struct RGBDStorage
+    {
+        RGBDStorage() : rgb(rgbd::RGB_STORAGE_JPG), depth(rgbd::DEPTH_STORAGE_PNG) {}
+        bool operator==(const RGBDStorage& s) const { return rgb == s.rgb && depth == s.depth; }
+        rgbd::RGBStorageType rgb;
+        rgbd::DepthStorageType depth;
+    };
+
+    // Storage type of each rgbd topic (same order as pubs_rgbd_)
+    std::vector<RGBDStorage> rgbd_storage_;
+
+    // Output pipeline for compressed outputs: process() renders, the encode stage compresses and
+    // serializes, the publish stage sends the messages. Each stage runs on the thread pool.
+
+    struct EncodeFrame
+    {
+        sim::ObjectPool<cv::Mat>::Ptr rgb, depth;
+        double time;
+    };
+
+    void encode(const EncodeFrame& frame);
+
+    sim::ObjectPool<sensor_msgs::CompressedImage> compressed_depth_msgs_;
+
+    // Encoded message per rgbd topic (only used by the encode stage)
+    std::vector<rgbd::RGBDMsgPtr> rgbd_encoded_;
+
+    // Declared last, so the stages are finished before the members they use are destroyed
+    boost::scoped_ptr<sim::PipelineStage<sim::Task> > publish_stage_;
+    boost::scoped_ptr<sim::PipelineStage<EncodeFrame> > encode_stage_;
+
 };
 
 #endif
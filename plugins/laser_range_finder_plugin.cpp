@@ -15,13 +15,35 @@
 #include <sensor_msgs/CameraInfo.h>
 #include <ros/node_handle.h>
 
-#include <ed/world_model.h>
+#include "fast_simulator2/world.h"
 #include <ed/uuid.h>
 #include <ed/entity.h>
 
+#include <cmath>
+
+namespace
+{
+
+// Tolerances within which the scan plane is considered unchanged (m, and cosine of the tilt)
+const double PLANE_OFFSET_TOLERANCE = 1e-4;
+const double PLANE_TILT_TOLERANCE = 1 - 1e-8;
+
+bool samePose(const geo::Pose3D& a, const geo::Pose3D& b)
+{
+    for(int i = 0; i < 9; ++i)
+    {
+        if (a.R.m[i] != b.R.m[i])
+            return false;
+    }
+
+    return a.t.x == b.t.x && a.t.y == b.t.y && a.t.z == b.t.z;
+}
+
+}
+
 // ----------------------------------------------------------------------------------------------------
 
-LaserRangeFinderPlugin::LaserRangeFinderPlugin()
+LaserRangeFinderPlugin::LaserRangeFinderPlugin() : has_plane_(false)
 {
 }
 
@@ -49,6 +71,9 @@ void LaserRangeFinderPlugin::configure(tue::Configuration config, const sim::LUI
     lrf_.setAngleLimits(min_angle, max_angle);
     lrf_.setRangeLimits(min_range, max_range);
 
+    caster_.configure(lrf_.getAngleMin(), lrf_.getAngleIncrement(), lrf_.getNumBeams(), lrf_.getRangeMin(),
+                      lrf_.getRangeMax());
+
     // Make sure ROS is initialized
     if (!ros::isInitialized())
          ros::init(ros::M_string(), "simulator", ros::init_options::NoSigintHandler);
@@ -73,43 +98,99 @@ void LaserRangeFinderPlugin::configure(tue::Configuration config, const sim::LUI
 
 // ----------------------------------------------------------------------------------------------------
 
-void LaserRangeFinderPlugin::process(const ed::WorldModel& world, const sim::LUId& obj_id, double dt, ed::UpdateRequest& req)
+void LaserRangeFinderPlugin::process(const sim::World& world, const sim::LUId& obj_id, double time, double dt, ed::UpdateRequest& req)
 {
-    // Get ROS current time
-    ros::Time time = ros::Time::now();
+    // Nobody is listening: don't render
+    if (!demanded(pub_))
+        return;
+
+    // Stamp with the simulated time
+    ros::Time stamp(time);
 
     geo::Pose3D laser_pose;
-    if (!world.calculateTransform("world", obj_id.id, time.toSec(), laser_pose))
+    if (!world.worldPose(obj_id, time, laser_pose))
         return;
 
-    geo::Pose3D laser_pose_inv = laser_pose.inverse();
+    // The slices are expressed in the frame of the laser at the time the scan plane was last set. As
+    // long as the laser stays within that plane (e.g. the robot drives around), they stay valid.
+    geo::Pose3D laser_in_plane = plane_pose_inv_ * laser_pose;
+    if (!has_plane_ || std::abs(laser_in_plane.t.z) > PLANE_OFFSET_TOLERANCE || laser_in_plane.R.zz < PLANE_TILT_TOLERANCE)
+    {
+        // The plane changed (e.g. the torso moved the laser up or down): all slices are invalid
+        plane_pose_inv_ = laser_pose.inverse();
+        laser_in_plane = geo::Pose3D::identity();
+        slices_.clear();
+        has_plane_ = true;
+    }
+
+    // Only entities that intersect the scan plane within range of the laser can be hit
+    sim::Slab scan_area(laser_pose.t, laser_pose.R * geo::Vec3(0, 0, 1), 0, lrf_.getRangeMax());
+    world.spatialIndex().query(scan_area, entities_in_range_);
+
+    const sim::StaticGeometry& static_geometry = world.staticGeometry();
 
-    std::vector<double> ranges(lrf_.getNumBeams(), 0);
-    for(ed::WorldModel::const_iterator it = world.begin(); it != world.end(); ++it)
+    if (slices_.size() < world.entityCapacity())
+        slices_.resize(world.entityCapacity());
+
+    // Transformation from the plane frame to the laser frame (a rotation and translation within the plane)
+    double yaw = std::atan2(laser_in_plane.R.yx, laser_in_plane.R.xx);
+    float c = std::cos(yaw), s = std::sin(yaw);
+    float tx = laser_in_plane.t.x, ty = laser_in_plane.t.y;
+
+    segments_.clear();
+    for(std::vector<int>::const_iterator it = entities_in_range_.begin(); it != entities_in_range_.end(); ++it)
     {
-        const ed::EntityConstPtr& e = *it;
+        // Mesh and its pose in the world frame, and the object that owns the mesh
+        const geo::Mesh* mesh;
+        geo::Pose3D pose;
+        boost::shared_ptr<const void> source;
+
+        if (static_geometry.isStatic(*it))
+        {
+            // Already in the world frame
+            const sim::StaticGeometry::PartConstPtr& part = static_geometry.part(*it);
+            mesh = &part->mesh;
+            pose = geo::Pose3D::identity();
+            source = part;
+        }
+        else
+        {
+            const ed::EntityConstPtr& e = world.entity(*it);
+            if (!e || !e->shape())
+                continue;
 
-        if (e->shape())
+            mesh = &e->shape()->getMesh();
+            pose = e->pose();
+            source = e->shape();
+        }
+
+        // Only slice entities that are new or changed since the previous cycle
+        Slice& slice = slices_[*it];
+        if (slice.source != source || !samePose(slice.pose, pose))
         {
-            // Set render options
-            geo::LaserRangeFinder::RenderOptions opt;
-            opt.setMesh(e->shape()->getMesh(), laser_pose_inv * e->pose());
+            slice.source = source;
+            slice.pose = pose;
+            slice.segments.clear();
+            slicer_.slice(*mesh, plane_pose_inv_ * pose, slice.segments);
+        }
 
-            geo::LaserRangeFinder::RenderResult res(ranges);
-            lrf_.render(opt, res);
+        for(std::vector<sim::LineSegment>::const_iterator it_s = slice.segments.begin(); it_s != slice.segments.end(); ++it_s)
+        {
+            float dx1 = it_s->x1 - tx, dy1 = it_s->y1 - ty;
+            float dx2 = it_s->x2 - tx, dy2 = it_s->y2 - ty;
+            segments_.push_back(sim::LineSegment(c * dx1 + s * dy1, -s * dx1 + c * dy1, c * dx2 + s * dy2, -s * dx2 + c * dy2));
         }
     }
 
     // Make sure ranges in scan message is correct size
-    if (scan_.ranges.size() != lrf_.getNumBeams())
-        scan_.ranges.resize(lrf_.getNumBeams());
+    if (scan_.ranges.size() != caster_.numBeams())
+        scan_.ranges.resize(caster_.numBeams());
 
-    // Copy ranges to scan message
-    for(unsigned int i = 0; i < ranges.size(); ++i)
-        scan_.ranges[i] = ranges[i];
+    if (!scan_.ranges.empty())
+        caster_.cast(segments_, &scan_.ranges[0], &threadPool());
 
     // Stamp with current ROS time
-    scan_.header.stamp = time;
+    scan_.header.stamp = stamp;
 
     pub_.publish(scan_);
 }
@@ -2,6 +2,7 @@
 #define FAST_SIMULATOR2_LASER_RANGE_FINDER_H_
 
 #include "fast_simulator2/plugin.h"
+#include "fast_simulator2/laser_scan.h"
 
 #include <geolib/sensors/LaserRangeFinder.h>
 #include <ros/publisher.h>
@@ -18,7 +19,7 @@ public:
 
     void configure(tue::Configuration config, const sim::LUId& obj_id);
 
-    void process(const ed::WorldModel& world, const sim::LUId& obj_id, double dt, ed::UpdateRequest& req);
+    void process(const sim::World& world, const sim::LUId& obj_id, double time, double dt, ed::UpdateRequest& req);
 
 private:
 
@@ -28,6 +29,35 @@ private:
 
     sensor_msgs::LaserScan scan_;
 
+    // Indices of the entities within range (kept to prevent re-allocation every cycle)
+    std::vector<int> entities_in_range_;
+
+    // - - - - - - - - - - - - - - - 2D slices - - - - - - - - - - - - - - -
+
+    // Intersection of the mesh of an entity with the scan plane, in the plane frame
+    struct Slice
+    {
+        // Shape or static part the slice was computed from, and its pose in the world frame
+        boost::shared_ptr<const void> source;
+        geo::Pose3D pose;
+
+        std::vector<sim::LineSegment> segments;
+    };
+
+    // Inverse of the pose of the laser when the scan plane was set
+    bool has_plane_;
+    geo::Pose3D plane_pose_inv_;
+
+    // Entity index -> slice
+    std::vector<Slice> slices_;
+
+    sim::PlaneSlicer slicer_;
+
+    sim::BeamCaster caster_;
+
+    // Segments within range, in the laser frame (kept to prevent re-allocation every cycle)
+    std::vector<sim::LineSegment> segments_;
+
 };
 
 #endif
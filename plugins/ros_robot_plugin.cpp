@@ -173,7 +173,7 @@ bool ROSRobotPlugin::updateJoint(const std::string& name, double pos, ed::Update
 
 // ----------------------------------------------------------------------------------------------------
 
-void ROSRobotPlugin::process(const ed::WorldModel& world, const sim::LUId& obj_id, double dt, ed::UpdateRequest& req)
+void ROSRobotPlugin::process(const sim::World& world, const sim::LUId& obj_id, double time, double dt, ed::UpdateRequest& req)
 {
     if (!init_update_request_.empty())
     {
@@ -186,15 +186,13 @@ void ROSRobotPlugin::process(const ed::WorldModel& world, const sim::LUId& obj_i
         return;
     }
 
-    publishJointStates();
+    publishJointStates(ros::Time(time));
 }
 
 // ----------------------------------------------------------------------------------------------------
 
-void ROSRobotPlugin::publishJointStates()
-{    
-    ros::Time ros_time = ros::Time::now();
-
+void ROSRobotPlugin::publishJointStates(const ros::Time& ros_time)
+{
     for(std::vector<JointGroup>::const_iterator it = joint_groups_.begin(); it != joint_groups_.end(); ++it)
     {
         const JointGroup& jg = *it;
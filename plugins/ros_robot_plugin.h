@@ -68,7 +68,7 @@ public:
 
     void configure(tue::Configuration config, const sim::LUId& obj_id);
 
-    void process(const ed::WorldModel& world, const sim::LUId& obj_id, double dt, ed::UpdateRequest& req);
+    void process(const sim::World& world, const sim::LUId& obj_id, double time, double dt, ed::UpdateRequest& req);
 
 private:
 
@@ -91,7 +91,7 @@ private:
 
     std::vector<JointGroup> joint_groups_;
 
-    void publishJointStates();
+    void publishJointStates(const ros::Time& ros_time);
 
 
     /// TF Publishing
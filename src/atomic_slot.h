@@ -0,0 +1,108 @@
+#ifndef FAST_SIMULATOR2_ATOMIC_SLOT_H_
+#define FAST_SIMULATOR2_ATOMIC_SLOT_H_
+
+#include <boost/atomic.hpp>
+
+namespace sim
+{
+
+// ----------------------------------------------------------------------------------------------------
+//
+// Lock-free single-value handoff between a producer and a consumer thread. publish() replaces any
+// value that was not taken yet, so the consumer always gets the latest one. Both sides only perform
+// atomic exchanges on pointers; the value itself is never accessed by two threads at once.
+//
+// The boxes holding the values are recycled through two spare slots, so in the steady state
+// publish() and take() do not allocate (only T's own assignment may). At most three boxes are in use
+// at a time: one in the slot and one in the hands of each side.
+//
+// ----------------------------------------------------------------------------------------------------
+
+template<typename T>
+class AtomicSlot
+{
+
+public:
+
+    AtomicSlot() : box_(0)
+    {
+        for(unsigned int i = 0; i < NUM_SPARES; ++i)
+            spares_[i].store(0);
+    }
+
+    ~AtomicSlot()
+    {
+        delete box_.exchange(0);
+        for(unsigned int i = 0; i < NUM_SPARES; ++i)
+            delete spares_[i].exchange(0);
+    }
+
+    void publish(const T& value)
+    {
+        Box* b = 0;
+        for(unsigned int i = 0; i < NUM_SPARES && !b; ++i)
+            b = spares_[i].exchange(0, boost::memory_order_acq_rel);
+
+        if (b)
+            b->value = value;
+        else
+            b = new Box(value);
+
+        Box* old = box_.exchange(b, boost::memory_order_acq_rel);
+        if (old)
+            recycle(old);
+    }
+
+    // Takes the latest published value. Returns false if nothing was published since the last take.
+    bool take(T& value)
+    {
+        Box* b = box_.exchange(0, boost::memory_order_acq_rel);
+        if (!b)
+            return false;
+
+        value = b->value;
+        recycle(b);
+        return true;
+    }
+
+    bool empty() const { return box_.load(boost::memory_order_acquire) == 0; }
+
+private:
+
+    struct Box
+    {
+        Box(const T& value_) : value(value_) {}
+        T value;
+    };
+
+    boost::atomic<Box*> box_;
+
+    static const unsigned int NUM_SPARES = 2;
+
+    // Boxes that are not in use, to be reused by publish()
+    boost::atomic<Box*> spares_[NUM_SPARES];
+
+    void recycle(Box* b)
+    {
+        // Release the old value now, so the spare box does not keep it alive (e.g. a world snapshot)
+        b->value = T();
+
+        for(unsigned int i = 0; i < NUM_SPARES; ++i)
+        {
+            Box* empty = 0;
+            if (spares_[i].compare_exchange_strong(empty, b, boost::memory_order_acq_rel))
+                return;
+        }
+
+        delete b;
+    }
+
+    // Not copyable
+    AtomicSlot(const AtomicSlot&);
+    AtomicSlot& operator=(const AtomicSlot&);
+
+};
+
+} // end namespace sim
+
+#endif
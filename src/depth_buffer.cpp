@@ -0,0 +1,141 @@
+#include "fast_simulator2/depth_buffer.h"
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace sim
+{
+
+namespace
+{
+
+// Depth-tests n values of 'src' against 'dst'. Empty (0) values of 'src' are skipped, so merging a
+// partially rendered buffer leaves the pixels it did not render untouched.
+inline void depthTest(float* dst, const float* src, int n)
+{
+    int i = 0;
+
+#if defined(__AVX__)
+    const __m256 zero = _mm256_setzero_ps();
+    for(; i + 8 <= n; i += 8)
+    {
+        __m256 d_old = _mm256_loadu_ps(dst + i);
+        __m256 d_new = _mm256_loadu_ps(src + i);
+
+        // Take the new depth if it is not empty, and the pixel is empty or the new depth is closer
+        __m256 mask = _mm256_and_ps(_mm256_cmp_ps(d_new, zero, _CMP_NEQ_OQ),
+                                     _mm256_or_ps(_mm256_cmp_ps(d_old, zero, _CMP_EQ_OQ), _mm256_cmp_ps(d_new, d_old, _CMP_LT_OQ)));
+        _mm256_storeu_ps(dst + i, _mm256_blendv_ps(d_old, d_new, mask));
+    }
+#elif defined(__SSE2__)
+    const __m128 zero = _mm_setzero_ps();
+    for(; i + 4 <= n; i += 4)
+    {
+        __m128 d_old = _mm_loadu_ps(dst + i);
+        __m128 d_new = _mm_loadu_ps(src + i);
+
+        // Take the new depth if it is not empty, and the pixel is empty or the new depth is closer
+        __m128 mask = _mm_and_ps(_mm_cmpneq_ps(d_new, zero),
+                                 _mm_or_ps(_mm_cmpeq_ps(d_old, zero), _mm_cmplt_ps(d_new, d_old)));
+        _mm_storeu_ps(dst + i, _mm_or_ps(_mm_and_ps(mask, d_new), _mm_andnot_ps(mask, d_old)));
+    }
+#endif
+
+    for(; i < n; ++i)
+    {
+        if (src[i] != 0 && (dst[i] == 0 || src[i] < dst[i]))
+            dst[i] = src[i];
+    }
+}
+
+// Same as depthTest, but also copies the label of each pixel that takes the new depth. The labels
+// come from 'src_labels' or, if that is null, are all 'label'.
+inline void depthTestLabels(float* dst, const float* src, int* dst_labels, const int* src_labels, int label, int n)
+{
+    int i = 0;
+
+#if defined(__AVX__)
+    const __m256 zero = _mm256_setzero_ps();
+    const __m256 l_const = _mm256_castsi256_ps(_mm256_set1_epi32(label));
+    for(; i + 8 <= n; i += 8)
+    {
+        __m256 d_old = _mm256_loadu_ps(dst + i);
+        __m256 d_new = _mm256_loadu_ps(src + i);
+        __m256 mask = _mm256_and_ps(_mm256_cmp_ps(d_new, zero, _CMP_NEQ_OQ),
+                                     _mm256_or_ps(_mm256_cmp_ps(d_old, zero, _CMP_EQ_OQ), _mm256_cmp_ps(d_new, d_old, _CMP_LT_OQ)));
+        _mm256_storeu_ps(dst + i, _mm256_blendv_ps(d_old, d_new, mask));
+
+        // Labels are blended as bit patterns with the same mask
+        __m256 l_old = _mm256_castsi256_ps(_mm256_loadu_si256((const __m256i*)(dst_labels + i)));
+        __m256 l_new = src_labels ? _mm256_castsi256_ps(_mm256_loadu_si256((const __m256i*)(src_labels + i))) : l_const;
+        _mm256_storeu_si256((__m256i*)(dst_labels + i), _mm256_castps_si256(_mm256_blendv_ps(l_old, l_new, mask)));
+    }
+#elif defined(__SSE2__)
+    const __m128 zero = _mm_setzero_ps();
+    const __m128i l_const = _mm_set1_epi32(label);
+    for(; i + 4 <= n; i += 4)
+    {
+        __m128 d_old = _mm_loadu_ps(dst + i);
+        __m128 d_new = _mm_loadu_ps(src + i);
+        __m128 mask = _mm_and_ps(_mm_cmpneq_ps(d_new, zero),
+                                 _mm_or_ps(_mm_cmpeq_ps(d_old, zero), _mm_cmplt_ps(d_new, d_old)));
+        _mm_storeu_ps(dst + i, _mm_or_ps(_mm_and_ps(mask, d_new), _mm_andnot_ps(mask, d_old)));
+
+        // Labels are blended as bit patterns with the same mask
+        __m128i mask_i = _mm_castps_si128(mask);
+        __m128i l_old = _mm_loadu_si128((const __m128i*)(dst_labels + i));
+        __m128i l_new = src_labels ? _mm_loadu_si128((const __m128i*)(src_labels + i)) : l_const;
+        _mm_storeu_si128((__m128i*)(dst_labels + i), _mm_or_si128(_mm_and_si128(mask_i, l_new), _mm_andnot_si128(mask_i, l_old)));
+    }
+#endif
+
+    for(; i < n; ++i)
+    {
+        if (src[i] != 0 && (dst[i] == 0 || src[i] < dst[i]))
+        {
+            dst[i] = src[i];
+            dst_labels[i] = src_labels ? src_labels[i] : label;
+        }
+    }
+}
+
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+void DepthBuffer::writeSpan(int x, int y, const float* depths, int n, int label)
+{
+    if (labels_)
+        depthTestLabels(row(y) + x, depths, labelRow(y) + x, 0, label, n);
+    else
+        depthTest(row(y) + x, depths, n);
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+void DepthBuffer::merge(const DepthBuffer& other, int row_begin, int row_end)
+{
+    if (labels_ && other.labels_)
+    {
+        for(int y = row_begin; y < row_end; ++y)
+            depthTestLabels(row(y), other.row(y), labelRow(y), other.labelRow(y), 0, width_);
+    }
+    else
+    {
+        for(int y = row_begin; y < row_end; ++y)
+            depthTest(row(y), other.row(y), width_);
+    }
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+DepthBufferRenderResult::DepthBufferRenderResult(const DepthBuffer& buffer)
+    : geo::RenderResult(buffer.width(), buffer.height()), buffer_(buffer), span_x_(-1), span_y_(-1),
+      span_size_(0), label_(0)
+{
+}
+
+} // end namespace sim
@@ -0,0 +1,174 @@
+#include "fast_simulator2/depth_codec.h"
+
+#include <stdint.h>
+#include <cstring>
+
+namespace sim
+{
+
+const char* const DEPTH_CODEC_FORMAT = "32FC1; sim_depth_rle";
+
+namespace
+{
+
+// Images larger than this (in either dimension, or in total) are rejected by the decoder
+const uint64_t MAX_IMAGE_SIZE = 1 << 16;
+const uint64_t MAX_NUM_PIXELS = 1 << 26;
+
+inline uint32_t floatBits(float f)
+{
+    uint32_t u;
+    std::memcpy(&u, &f, sizeof(u));
+    return u;
+}
+
+inline float bitsFloat(uint32_t u)
+{
+    float f;
+    std::memcpy(&f, &u, sizeof(f));
+    return f;
+}
+
+// Predicts the bit pattern of a pixel from its two left neighbours (a = left, b = left of a)
+inline uint32_t predict(uint32_t a, uint32_t b)
+{
+    return (a != 0 && b != 0) ? 2 * a - b : a;
+}
+
+inline void putVarint(uint64_t v, std::vector<unsigned char>& out)
+{
+    while(v >= 0x80)
+    {
+        out.push_back((unsigned char)(v | 0x80));
+        v >>= 7;
+    }
+    out.push_back((unsigned char)v);
+}
+
+inline bool getVarint(const unsigned char*& p, const unsigned char* end, uint64_t& v)
+{
+    v = 0;
+    for(int shift = 0; shift < 64 && p < end; shift += 7)
+    {
+        unsigned char c = *p++;
+        v |= (uint64_t)(c & 0x7f) << shift;
+        if (!(c & 0x80))
+            return true;
+    }
+    return false;
+}
+
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+void encodeDepth(const float* data, int width, int height, int stride, std::vector<unsigned char>& out)
+{
+    out.clear();
+
+    // Worst case is 5 bytes per pixel. Only allocates the first time if 'out' is reused.
+    out.reserve(16 + 5 * width * height);
+
+    putVarint(width, out);
+    putVarint(height, out);
+
+    for(int y = 0; y < height; ++y)
+    {
+        const float* row = data + y * stride;
+
+        uint32_t a = 0, b = 0;
+        uint64_t run = 0;
+
+        for(int x = 0; x < width; ++x)
+        {
+            uint32_t bits = floatBits(row[x]);
+            uint32_t r = bits - predict(a, b);
+
+            if (r == 0)
+            {
+                ++run;
+            }
+            else
+            {
+                if (run > 0)
+                {
+                    putVarint((run << 1) | 1, out);
+                    run = 0;
+                }
+
+                // Zigzag: small negative and positive residuals both become small numbers
+                uint32_t zz = (r << 1) ^ (uint32_t)((int32_t)r >> 31);
+                putVarint((uint64_t)zz << 1, out);
+            }
+
+            b = a;
+            a = bits;
+        }
+
+        if (run > 0)
+            putVarint((run << 1) | 1, out);
+    }
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+bool decodeDepth(const unsigned char* data, std::size_t size, int& width, int& height, std::vector<float>& out)
+{
+    const unsigned char* p = data;
+    const unsigned char* end = data + size;
+
+    uint64_t w, h;
+    if (!getVarint(p, end, w) || !getVarint(p, end, h) || w > MAX_IMAGE_SIZE || h > MAX_IMAGE_SIZE
+            || w * h > MAX_NUM_PIXELS)
+        return false;
+
+    // Every non-empty row needs at least one token of at least one byte
+    if (w > 0 && h > (uint64_t)(end - p))
+        return false;
+
+    width = w;
+    height = h;
+    out.resize(w * h);
+
+    for(int y = 0; y < height; ++y)
+    {
+        float* row = out.empty() ? 0 : &out[y * width];
+
+        uint32_t a = 0, b = 0;
+        int x = 0;
+
+        while(x < width)
+        {
+            uint64_t v;
+            if (!getVarint(p, end, v))
+                return false;
+
+            uint64_t n = 1;
+            uint32_t r = 0;
+
+            if (v & 1)
+            {
+                n = v >> 1;
+                if (n == 0 || n > (uint64_t)(width - x))
+                    return false;
+            }
+            else
+            {
+                uint32_t zz = (uint32_t)(v >> 1);
+                r = (zz >> 1) ^ (uint32_t)(-(int32_t)(zz & 1));
+            }
+
+            for(uint64_t i = 0; i < n; ++i, ++x)
+            {
+                uint32_t bits = predict(a, b) + r;
+                row[x] = bitsFloat(bits);
+                b = a;
+                a = bits;
+            }
+        }
+    }
+
+    return p == end;
+}
+
+} // end namespace sim
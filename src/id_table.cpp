@@ -0,0 +1,68 @@
+#include "fast_simulator2/id_table.h"
+
+#include <boost/thread/locks.hpp>
+#include <boost/thread/shared_mutex.hpp>
+#include <boost/unordered_map.hpp>
+
+namespace sim
+{
+
+namespace
+{
+
+struct IdTable
+{
+    // Lookups of IDs that are already interned (the common case) only take a shared lock
+    boost::shared_mutex mutex;
+    boost::unordered_map<std::string, int> keys;
+};
+
+// Constructed on first use, so it can be used during static initialization of other objects
+IdTable& idTable()
+{
+    static IdTable table;
+    return table;
+}
+
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+int internId(const std::string& id)
+{
+    int key;
+    if (findInternedId(id, key))
+        return key;
+
+    IdTable& table = idTable();
+    boost::unique_lock<boost::shared_mutex> lock(table.mutex);
+
+    // Another thread may have added it in the meantime, in which case insert() does nothing
+    return table.keys.insert(std::make_pair(id, (int)table.keys.size())).first->second;
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+bool findInternedId(const std::string& id, int& key)
+{
+    IdTable& table = idTable();
+    boost::shared_lock<boost::shared_mutex> lock(table.mutex);
+
+    boost::unordered_map<std::string, int>::const_iterator it = table.keys.find(id);
+    if (it == table.keys.end())
+        return false;
+
+    key = it->second;
+    return true;
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+unsigned int numInternedIds()
+{
+    IdTable& table = idTable();
+    boost::shared_lock<boost::shared_mutex> lock(table.mutex);
+    return table.keys.size();
+}
+
+} // end namespace sim
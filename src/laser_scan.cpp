@@ -0,0 +1,228 @@
+#include "fast_simulator2/laser_scan.h"
+#include "fast_simulator2/thread_pool.h"
+
+#include <boost/bind.hpp>
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include <algorithm>
+#include <cmath>
+
+namespace sim
+{
+
+namespace
+{
+
+// Casts with fewer beam tests, or sectors with fewer beams, are not worth splitting over tasks
+const unsigned long MIN_TESTS_PER_SECTOR = 20000;
+const unsigned int MIN_BEAMS_PER_SECTOR = 64;
+
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+void PlaneSlicer::slice(const geo::Mesh& mesh, const geo::Pose3D& pose, std::vector<LineSegment>& segments)
+{
+    const std::vector<geo::Vector3>& points = mesh.getPoints();
+
+    points_.resize(points.size());
+    for(unsigned int i = 0; i < points.size(); ++i)
+        points_[i] = pose * points[i];
+
+    const std::vector<geo::TriangleI>& triangles = mesh.getTriangleIs();
+    for(std::vector<geo::TriangleI>::const_iterator it = triangles.begin(); it != triangles.end(); ++it)
+    {
+        const geo::Vector3* p[3] = { &points_[it->i1], &points_[it->i2], &points_[it->i3] };
+
+        // Points with z = 0 count as below the plane, so an edge crosses the plane iff exactly one of
+        // its points is above it. A crossing triangle has exactly two crossing edges.
+        bool above[3] = { p[0]->z > 0, p[1]->z > 0, p[2]->z > 0 };
+        if (above[0] == above[1] && above[1] == above[2])
+            continue;
+
+        float xy[4];
+        int n = 0;
+        for(int i = 0; i < 3; ++i)
+        {
+            const geo::Vector3& a = *p[i];
+            const geo::Vector3& b = *p[(i + 1) % 3];
+            if (above[i] == above[(i + 1) % 3])
+                continue;
+
+            double t = a.z / (a.z - b.z);
+            xy[n++] = a.x + t * (b.x - a.x);
+            xy[n++] = a.y + t * (b.y - a.y);
+        }
+
+        segments.push_back(LineSegment(xy[0], xy[1], xy[2], xy[3]));
+    }
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+BeamCaster::BeamCaster() : angle_min_(0), angle_increment_(0), range_min_(0), range_max_(0)
+{
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+void BeamCaster::configure(double angle_min, double angle_increment, unsigned int num_beams, double range_min,
+                           double range_max)
+{
+    angle_min_ = angle_min;
+    angle_increment_ = angle_increment;
+    range_min_ = range_min;
+    range_max_ = range_max;
+
+    cos_.resize(num_beams);
+    sin_.resize(num_beams);
+    for(unsigned int i = 0; i < num_beams; ++i)
+    {
+        double a = angle_min + i * angle_increment;
+        cos_[i] = std::cos(a);
+        sin_[i] = std::sin(a);
+    }
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+void BeamCaster::cast(const std::vector<LineSegment>& segments, float* ranges, ThreadPool* pool)
+{
+    int num_beams = cos_.size();
+
+    // - - - - - - - - - - - - - - - Spans - - - - - - - - - - - - - - -
+
+    spans_.clear();
+    unsigned long num_tests = 0;
+
+    for(std::vector<LineSegment>::const_iterator it = segments.begin(); it != segments.end() && angle_increment_ > 0; ++it)
+    {
+        const LineSegment& s = *it;
+
+        // Only the beams between the angles of the end points can hit the segment. The segment does
+        // not contain the origin, so it spans less than half a turn: if the angles are further apart,
+        // the segment crosses the angle of -pi / pi.
+        double a1 = std::atan2(s.y1, s.x1);
+        double a2 = std::atan2(s.y2, s.x2);
+        double a_lo = std::min(a1, a2);
+        double a_hi = std::max(a1, a2);
+        if (a_hi - a_lo > M_PI)
+        {
+            std::swap(a_lo, a_hi);
+            a_hi += 2 * M_PI;
+        }
+
+        // The beam angles may extend beyond -pi / pi, so also try the span one turn earlier and later
+        for(int k = -1; k <= 1; ++k)
+        {
+            double f_begin = std::ceil((a_lo + k * 2 * M_PI - angle_min_) / angle_increment_);
+            double f_end = std::floor((a_hi + k * 2 * M_PI - angle_min_) / angle_increment_);
+            if (f_end < 0 || f_begin > num_beams - 1)
+                continue;
+
+            Span span;
+            span.i_begin = std::max(0.0, f_begin);
+            span.i_end = std::min<double>(num_beams - 1, f_end) + 1;
+            span.x1 = s.x1;
+            span.y1 = s.y1;
+            span.ex = s.x2 - s.x1;
+            span.ey = s.y2 - s.y1;
+            spans_.push_back(span);
+
+            num_tests += span.i_end - span.i_begin;
+        }
+    }
+
+    // - - - - - - - - - - - - - - - Casting - - - - - - - - - - - - - - -
+
+    unsigned int num_sectors = 1;
+    if (pool)
+    {
+        num_sectors = std::min<unsigned long>(pool->numThreads(), num_tests / MIN_TESTS_PER_SECTOR);
+        num_sectors = std::max(1u, std::min<unsigned int>(num_sectors, num_beams / MIN_BEAMS_PER_SECTOR));
+    }
+
+    if (num_sectors == 1)
+    {
+        castSector(0, num_beams, ranges);
+        return;
+    }
+
+    // Sectors write disjoint parts of 'ranges'
+    TaskGroup tasks(*pool);
+    int beams_per_sector = (num_beams + num_sectors - 1) / num_sectors;
+    for(int i = 0; i < num_beams; i += beams_per_sector)
+        tasks.run(boost::bind(&BeamCaster::castSector, this, i, std::min(i + beams_per_sector, num_beams), ranges));
+    tasks.wait();
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+void BeamCaster::castSector(int i_begin, int i_end, float* ranges) const
+{
+    std::fill(ranges + i_begin, ranges + i_end, 0.0f);
+
+    for(std::vector<Span>::const_iterator it = spans_.begin(); it != spans_.end(); ++it)
+    {
+        const Span& s = *it;
+        int i = std::max(s.i_begin, i_begin);
+        int end = std::min(s.i_end, i_end);
+
+        // The distance along beam (c, s) to the line through the segment is num / (c * ey - s * ex)
+        float num = s.x1 * s.ey - s.y1 * s.ex;
+
+        // A beam parallel to the segment gives an infinite (or NaN) distance, which fails the range test
+#if defined(__AVX__)
+        const __m256 v_ex = _mm256_set1_ps(s.ex);
+        const __m256 v_ey = _mm256_set1_ps(s.ey);
+        const __m256 v_num = _mm256_set1_ps(num);
+        const __m256 v_min = _mm256_set1_ps(range_min_);
+        const __m256 v_max = _mm256_set1_ps(range_max_);
+        const __m256 zero = _mm256_setzero_ps();
+        for(; i + 8 <= end; i += 8)
+        {
+            __m256 denom = _mm256_sub_ps(_mm256_mul_ps(_mm256_loadu_ps(&cos_[i]), v_ey),
+                                         _mm256_mul_ps(_mm256_loadu_ps(&sin_[i]), v_ex));
+            __m256 d = _mm256_div_ps(v_num, denom);
+            __m256 r = _mm256_loadu_ps(ranges + i);
+
+            // Take the new distance if it is within the limits and the beam has no closer hit yet
+            __m256 mask = _mm256_and_ps(_mm256_cmp_ps(d, v_min, _CMP_GE_OQ), _mm256_cmp_ps(d, v_max, _CMP_LE_OQ));
+            mask = _mm256_and_ps(mask, _mm256_or_ps(_mm256_cmp_ps(r, zero, _CMP_EQ_OQ), _mm256_cmp_ps(d, r, _CMP_LT_OQ)));
+            _mm256_storeu_ps(ranges + i, _mm256_blendv_ps(r, d, mask));
+        }
+#elif defined(__SSE2__)
+        const __m128 v_ex = _mm_set1_ps(s.ex);
+        const __m128 v_ey = _mm_set1_ps(s.ey);
+        const __m128 v_num = _mm_set1_ps(num);
+        const __m128 v_min = _mm_set1_ps(range_min_);
+        const __m128 v_max = _mm_set1_ps(range_max_);
+        const __m128 zero = _mm_setzero_ps();
+        for(; i + 4 <= end; i += 4)
+        {
+            __m128 denom = _mm_sub_ps(_mm_mul_ps(_mm_loadu_ps(&cos_[i]), v_ey), _mm_mul_ps(_mm_loadu_ps(&sin_[i]), v_ex));
+            __m128 d = _mm_div_ps(v_num, denom);
+            __m128 r = _mm_loadu_ps(ranges + i);
+
+            // Take the new distance if it is within the limits and the beam has no closer hit yet
+            __m128 mask = _mm_and_ps(_mm_cmpge_ps(d, v_min), _mm_cmple_ps(d, v_max));
+            mask = _mm_and_ps(mask, _mm_or_ps(_mm_cmpeq_ps(r, zero), _mm_cmplt_ps(d, r)));
+            _mm_storeu_ps(ranges + i, _mm_or_ps(_mm_and_ps(mask, d), _mm_andnot_ps(mask, r)));
+        }
+#endif
+
+        for(; i < end; ++i)
+        {
+            float d = num / (cos_[i] * s.ey - sin_[i] * s.ex);
+            if (d >= range_min_ && d <= range_max_ && (ranges[i] == 0 || d < ranges[i]))
+                ranges[i] = d;
+        }
+    }
+}
+
+} // end namespace sim
@@ -10,6 +10,103 @@
 
 #include <tue/profiling/timer.h>
 
+// Clock
+#include <ros/init.h>
+#include <ros/node_handle.h>
+#include <ros/param.h>
+#include <rosgraph_msgs/Clock.h>
+
+// Diagnostics
+#include "fast_simulator2/stats.h"
+#include <diagnostic_msgs/DiagnosticArray.h>
+
+// ----------------------------------------------------------------------------------------------------
+
+void addValue(diagnostic_msgs::DiagnosticStatus& status, const std::string& key, double value)
+{
+    diagnostic_msgs::KeyValue kv;
+    kv.key = key;
+
+    std::stringstream ss;
+    ss << value;
+    kv.value = ss.str();
+
+    status.values.push_back(kv);
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+void addHistogram(diagnostic_msgs::DiagnosticStatus& status, const std::string& key, const sim::Histogram& h)
+{
+    addValue(status, key + " count", h.count());
+    addValue(status, key + " mean [ms]", h.mean() * 1000);
+    addValue(status, key + " p95 [ms]", h.percentile(0.95) * 1000);
+    addValue(status, key + " max [ms]", h.max() * 1000);
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+// Running as fast as possible requires lockstep mode (otherwise the simulator does not wait for the
+// plugins at all), so an explicit 'lockstep: 0' conflicts with a real-time factor <= 0
+void checkLockstep(tue::Configuration& config, double real_time_factor)
+{
+    int lockstep;
+    if (real_time_factor <= 0 && config.value("lockstep", lockstep, tue::OPTIONAL) && !lockstep)
+        config.addError("'lockstep: 0' cannot be combined with a real_time_factor <= 0 (run as fast as possible).");
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+void publishDiagnostics(const sim::Simulator& simulator, const ros::Publisher& pub)
+{
+    diagnostic_msgs::DiagnosticArray msg;
+    msg.header.stamp = ros::Time(simulator.time());
+
+    msg.status.push_back(diagnostic_msgs::DiagnosticStatus());
+    diagnostic_msgs::DiagnosticStatus& status_sim = msg.status.back();
+    status_sim.name = "fast_simulator2";
+    status_sim.level = diagnostic_msgs::DiagnosticStatus::OK;
+    addHistogram(status_sim, "world copy", simulator.stats().world_copy_time);
+    addHistogram(status_sim, "merge", simulator.stats().merge_time);
+    addHistogram(status_sim, "poses", simulator.stats().poses_time);
+
+    std::map<std::string, sim::PluginStats> plugin_stats;
+    simulator.getPluginStats(plugin_stats);
+
+    for(std::map<std::string, sim::PluginStats>::const_iterator it = plugin_stats.begin(); it != plugin_stats.end(); ++it)
+    {
+        const sim::PluginStats& stats = it->second;
+
+        msg.status.push_back(diagnostic_msgs::DiagnosticStatus());
+        diagnostic_msgs::DiagnosticStatus& status = msg.status.back();
+        status.name = "fast_simulator2: " + it->first;
+
+        double achieved_frequency = stats.achievedFrequency();
+        if (stats.num_cycles > 1 && achieved_frequency < 0.9 * stats.configured_frequency)
+        {
+            status.level = diagnostic_msgs::DiagnosticStatus::WARN;
+            status.message = "Plugin does not reach its configured frequency";
+        }
+        else
+            status.level = diagnostic_msgs::DiagnosticStatus::OK;
+
+        addValue(status, "configured frequency [Hz]", stats.configured_frequency);
+        addValue(status, "achieved frequency [Hz]", achieved_frequency);
+        addValue(status, "cycles", stats.num_cycles);
+        addValue(status, "skipped (request pending)", stats.skipped_request_pending);
+        addValue(status, "skipped (busy)", stats.skipped_busy);
+        addHistogram(status, "process", stats.process_time);
+        addHistogram(status, "request latency", stats.request_latency);
+
+        for(std::map<std::string, double>::const_iterator it_value = stats.values.begin(); it_value != stats.values.end(); ++it_value)
+            addValue(status, it_value->first, it_value->second);
+    }
+
+    pub.publish(msg);
+}
+
+// ----------------------------------------------------------------------------------------------------
+
 int main(int argc, char **argv)
 {
     if (argc != 2)
@@ -42,6 +139,36 @@ int main(int argc, char **argv)
     // Load the YAML config file
     tue::Configuration config;
     config.loadFromYAMLFile(config_filename);
+
+    // Simulated clock. A real-time factor of 0 means: run as fast as possible
+    double step_size = 0.01;
+    double real_time_factor = 1;
+    if (config.readGroup("clock"))
+    {
+        config.value("step_size", step_size, tue::OPTIONAL);
+        config.value("real_time_factor", real_time_factor, tue::OPTIONAL);
+        config.endGroup();
+    }
+
+    // When running as fast as possible, the simulator must wait for the plugins every step
+    if (real_time_factor <= 0)
+        simulator.setLockstep(true);
+
+    checkLockstep(config, real_time_factor);
+    if (config.hasError())
+    {
+        std::cout << config.error() << std::endl;
+        return 1;
+    }
+
+    // Let all ROS nodes (including this one and the plugins) follow the simulated time. roscpp reads
+    // the parameter when the node starts (the first NodeHandle), so it must be set before the plugins
+    // are configured.
+    if (!ros::isInitialized())
+         ros::init(ros::M_string(), "simulator", ros::init_options::NoSigintHandler);
+
+    ros::param::set("/use_sim_time", true);
+
     simulator.configure(config);
 
     if (config.hasError())
@@ -52,11 +179,24 @@ int main(int argc, char **argv)
 
     // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
 
+    ros::NodeHandle nh;
+    ros::Publisher pub_clock = nh.advertise<rosgraph_msgs::Clock>("/clock", 1);
+
+    // Diagnostics are published once per second (wall-clock time)
+    ros::Publisher pub_diagnostics = nh.advertise<diagnostic_msgs::DiagnosticArray>("/diagnostics", 1);
+    ros::WallTime t_last_diagnostics = ros::WallTime::now();
+
+    ros::WallTime t_start = ros::WallTime::now();
+    double sim_time_start = simulator.time();
+
     while(true)
     {
         // Check if reconfiguration is needed
         if (config.sync())
         {
+            if (!config.hasError())
+                checkLockstep(config, real_time_factor);
+
             if (config.hasError())
                 std::cout << config.error() << std::endl;
             else
@@ -68,9 +208,27 @@ int main(int argc, char **argv)
         }
 
         // Step the simulator
-        simulator.step(0.01);
+        simulator.step(step_size);
 
-        usleep(10000);
+        rosgraph_msgs::Clock clock_msg;
+        clock_msg.clock = ros::Time(simulator.time());
+        pub_clock.publish(clock_msg);
+
+        ros::WallTime t_now = ros::WallTime::now();
+        if ((t_now - t_last_diagnostics).toSec() >= 1.0)
+        {
+            publishDiagnostics(simulator, pub_diagnostics);
+            t_last_diagnostics = t_now;
+        }
+
+        if (real_time_factor > 0)
+        {
+            // Sleep until the wall-clock time corresponding to the simulated time
+            ros::WallTime t_target = t_start + ros::WallDuration((simulator.time() - sim_time_start) / real_time_factor);
+            ros::WallDuration t_sleep = t_target - ros::WallTime::now();
+            if (t_sleep > ros::WallDuration(0))
+                t_sleep.sleep();
+        }
     }
 
     return 0;
@@ -1,19 +1,18 @@
 #include "plugin_container.h"
 
 //#include "fast_simulator2/update_request.h"
-//#include "fast_simulator2/world.h"
+#include "fast_simulator2/world.h"
 
 #include <ed/update_request.h>
 
-#include <ros/rate.h> // TODO: make own implementation
-
 namespace sim
 {
 
 // --------------------------------------------------------------------------------
 
-PluginContainer::PluginContainer()
-    : class_loader_(0), cycle_duration_(0.1), loop_frequency_(10), stop_(false), step_finished_(true), t_last_update_(0)
+PluginContainer::PluginContainer(ThreadPool& thread_pool, RenderService& render_service)
+    : class_loader_(0), thread_pool_(thread_pool), render_service_(render_service), cycle_duration_(0.1), loop_frequency_(10),
+      event_driven_(false), step_finished_(true), t_last_update_(-1), t_next_cycle_(0), blocked_(NOT_BLOCKED)
 {
 }
 
@@ -21,10 +20,8 @@ PluginContainer::PluginContainer()
 
 PluginContainer::~PluginContainer()
 {
-    stop_ = true;
-
-    if (thread_)
-        thread_->join();
+    if (plugin_)
+        render_service_.removeViews(plugin_.get());
 
     plugin_.reset();
     delete class_loader_;
@@ -51,24 +48,9 @@ PluginPtr PluginContainer::loadPlugin(const std::string plugin_name, const std::
         error += "Multiple plugins registered in '" + class_loader_->getLibraryPath() + "'.";
     } else
     {
-        plugin_ = class_loader_->createInstance<Plugin>(classes.front());
-        if (plugin_)
-        {
-            config.value("_object", object_id_.id, tue::OPTIONAL);
-
-            // Configure plugin
-            plugin_->configure(config, object_id_);
-            plugin_->name_ = plugin_name;
-
-            if (config.hasError())
-            {
-                std::cout << "ERROR while configuring plugin '" + plugin_name + "':" << std::endl;
-                std::cout << config.error() << std::endl;
-                plugin_.reset();
-            }
-
-            return plugin_;
-        }
+        PluginPtr plugin = class_loader_->createInstance<Plugin>(classes.front());
+        if (plugin)
+            return setPlugin(plugin_name, plugin, config);
     }
 
     return PluginPtr();
@@ -76,70 +58,161 @@ PluginPtr PluginContainer::loadPlugin(const std::string plugin_name, const std::
 
 // --------------------------------------------------------------------------------
 
-void PluginContainer::runThreaded()
+PluginPtr PluginContainer::setPlugin(const std::string plugin_name, const PluginPtr& plugin, tue::Configuration config)
 {
-    thread_ = boost::shared_ptr<boost::thread>(new boost::thread(boost::bind(&PluginContainer::run, this)));
-}
+    plugin_ = plugin;
 
-// --------------------------------------------------------------------------------
+    config.value("_object", object_id_.id, tue::OPTIONAL);
 
-void PluginContainer::run()
-{
-    if (!ros::Time::isValid())
-        ros::Time::init();
+    // Optional plugin rate (in simulated time)
+    double frequency;
+    if (config.value("_frequency", frequency, tue::OPTIONAL) && frequency > 0)
+        setLoopFrequency(frequency);
 
-    ros::Rate r(loop_frequency_);
-    while(!stop_)
+    int event_driven;
+    if (config.value("_event_driven", event_driven, tue::OPTIONAL))
+        event_driven_ = event_driven;
+
+    // Configure plugin
+    plugin_->thread_pool_ = &thread_pool_;
+    plugin_->render_service_ = &render_service_;
+    plugin_->configure(config, object_id_);
+    plugin_->name_ = plugin_name;
+
+    if (config.hasError())
     {
-        step();
-        r.sleep();
+        std::cout << "ERROR while configuring plugin '" + plugin_name + "':" << std::endl;
+        std::cout << config.error() << std::endl;
+        render_service_.removeViews(plugin_.get());
+        plugin_.reset();
     }
+
+    return plugin_;
 }
 
 // --------------------------------------------------------------------------------
 
-void PluginContainer::step()
+bool PluginContainer::startCycle(double time, bool new_world, double& dt)
 {
-    // If we still have an update_request, it means the request is not yet handled,
-    // so we have to skip this cycle (and wait until the world model has handled it)
+    bool cycle_due = time + 1e-9 >= t_next_cycle_;
+    if (!cycle_due && !(event_driven_ && new_world))
+        return false;
+
+    if (!step_finished_)
     {
-        boost::lock_guard<boost::mutex> lg(mutex_update_request_);
-        if (update_request_)
-            return;
+        blocked_ = BLOCKED_BUSY;
+        return false;
     }
 
-    // Check if there is a new world. If so replace the current one with the new one
+    if (!update_request_.empty())
     {
-        boost::lock_guard<boost::mutex> lg(mutex_world_);
-        if (world_new_)
-        {
-            world_current_ = world_new_;
-            world_new_.reset();
-        }
+        blocked_ = BLOCKED_REQUEST_PENDING;
+        return false;
+    }
+
+    dt = t_last_update_ < 0 ? cycle_duration_ : time - t_last_update_;
+    t_last_update_ = time;
+
+    boost::lock_guard<boost::mutex> lg(mutex_stats_);
+
+    if (cycle_due)
+    {
+        // Count the cycles we missed because we were blocked
+        unsigned long num_missed = (time - t_next_cycle_) / cycle_duration_ + 1e-9;
+        if (blocked_ == BLOCKED_BUSY)
+            stats_.skipped_busy += num_missed;
+        else if (blocked_ == BLOCKED_REQUEST_PENDING)
+            stats_.skipped_request_pending += num_missed;
+
+        // If we fell behind, skip the missed cycles instead of trying to catch up
+        t_next_cycle_ += cycle_duration_;
+        if (t_next_cycle_ <= time)
+            t_next_cycle_ = time + cycle_duration_;
     }
 
-    if (world_current_)
+    blocked_ = NOT_BLOCKED;
+    step_finished_ = false;
+
+    if (stats_.num_cycles == 0)
+        stats_.t_first_cycle = time;
+    stats_.t_last_cycle = time;
+    ++stats_.num_cycles;
+
+    return true;
+}
+
+// --------------------------------------------------------------------------------
+
+void PluginContainer::step(double dt)
+{
+    // Check if there is a new world. If so replace the current one with the new one
+    world_new_.take(world_current_);
+
+    if (world_current_.world)
     {
-        ed::UpdateRequestPtr update_request(new ed::UpdateRequest);
+        const World& world = *world_current_.world;
+
+        // Only allocate a new request after the previous one was handed to the simulator. Most plugins
+        // (e.g. sensors) leave it empty, so the same request is reused every cycle.
+        if (!update_request_next_)
+            update_request_next_.reset(new ed::UpdateRequest);
 
-        plugin_->process(*world_current_, cycle_duration_, *update_request);
+        ed::UpdateRequest& update_request = *update_request_next_;
+
+        tue::Timer timer;
+        timer.start();
+
+        plugin_->process(world, world_current_.time, dt, update_request);
 
         if (!object_id_.id.empty())
-            plugin_->process(*world_current_, object_id_, cycle_duration_, *update_request);
+            plugin_->process(world, object_id_, world_current_.time, dt, update_request);
+
+        timer.stop();
+
+        {
+            boost::lock_guard<boost::mutex> lg(mutex_stats_);
+            stats_.process_time.add(timer.getElapsedTimeInSec());
+        }
 
-        // If the received update_request was not empty, set it
-        if (!update_request->empty())
-            update_request_ = update_request;
+        // If the received update_request was not empty, hand it to the simulator
+        if (!update_request.empty())
+        {
+            timer_request_.start();
+            update_request_.publish(update_request_next_);
+            update_request_next_.reset();
+        }
     }
+
+    // Views that were not rendered this cycle no longer hold up the other cameras of the batch
+    if (!plugin_->render_views_.empty())
+        render_service_.release(plugin_->render_views_);
+
+    step_finished_ = true;
 }
 
 // --------------------------------------------------------------------------------
 
-void PluginContainer::stop()
+bool PluginContainer::takeUpdateRequest(ed::UpdateRequestConstPtr& req)
 {
-    stop_ = true;
-    thread_->join();
-    plugin_.reset();
+    if (!update_request_.take(req))
+        return false;
+
+    boost::lock_guard<boost::mutex> lg(mutex_stats_);
+    stats_.request_latency.add(timer_request_.getElapsedTimeInSec());
+
+    return true;
+}
+
+// --------------------------------------------------------------------------------
+
+PluginStats PluginContainer::stats() const
+{
+    boost::lock_guard<boost::mutex> lg(mutex_stats_);
+    PluginStats stats = stats_;
+    stats.configured_frequency = loop_frequency_;
+    if (plugin_)
+        stats.values = plugin_->diagnostics();
+    return stats;
 }
 
 // --------------------------------------------------------------------------------
@@ -2,7 +2,11 @@
 #define FAST_SIMULATOR2_PLUGIN_CONTAINER_H_
 
 #include "fast_simulator2/types.h"
+#include "fast_simulator2/stats.h"
+#include "atomic_slot.h"
+#include <boost/atomic.hpp>
 #include <boost/thread.hpp>
+#include <tue/profiling/timer.h>
 #include <tue/config/configuration.h>
 #include "fast_simulator2/plugin.h"
 
@@ -18,76 +22,117 @@ class PluginContainer
 
 public:
 
-    PluginContainer();
+    PluginContainer(ThreadPool& thread_pool, RenderService& render_service);
 
     virtual ~PluginContainer();
 
     PluginPtr loadPlugin(const std::string plugin_name, const std::string& lib_filename,
                     tue::Configuration config, std::string& error);
 
-    PluginPtr plugin() const { return plugin_; }
+    // Configures the given plugin and sets it as the plugin of this container. Used for plugins
+    // that are not loaded from a library.
+    PluginPtr setPlugin(const std::string plugin_name, const PluginPtr& plugin, tue::Configuration config);
 
-    void runThreaded();
+    PluginPtr plugin() const { return plugin_; }
 
-    void stop();
+    // Views the plugin registered with the render service
+    const std::vector<int>& renderViews() const { return plugin_->render_views_; }
 
     const std::string& name() const { return plugin_->name(); }
 
-    ed::UpdateRequestConstPtr updateRequest() const
-    {
-        boost::lock_guard<boost::mutex> lg(mutex_update_request_);
-        return update_request_;
-    }
+    // Takes the update request of the last cycle (if any). Until this is called, the plugin will not
+    // start a new cycle.
+    bool takeUpdateRequest(ed::UpdateRequestConstPtr& req);
 
-    void clearUpdateRequest()
-    {
-        boost::lock_guard<boost::mutex> lg(mutex_update_request_);
-        update_request_.reset();
-    }
+    // Sets the world snapshot and the simulated time it corresponds to
+    void setWorld(const WorldConstPtr& world, double time) { world_new_.publish(WorldStamped(world, time)); }
 
-    void setWorld(const ed::WorldModelConstPtr& world)
-    {
-        boost::lock_guard<boost::mutex> lg(mutex_world_);
-        world_new_ = world;
-    }
+    void setLoopFrequency(double freq) { loop_frequency_ = freq; cycle_duration_ = 1.0 / freq; }
+
+    // An event-driven plugin does not only run at its loop frequency, but also as soon as a new
+    // world is published (at most once per simulator step)
+    void setEventDriven(bool event_driven) { event_driven_ = event_driven; }
 
-    void setLoopFrequency(double freq) { loop_frequency_ = freq; }
+    // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+    // Scheduling. The plugin does not have its own thread: the simulator checks every step
+    // whether the plugin is due (in simulated time) and if so runs step() as a task on the
+    // shared thread pool.
+
+    // Starts a cycle at the given time if the plugin is due: the previous cycle is finished, its update
+    // request has been taken, and either the next cycle is due at the given time or the plugin is
+    // event-driven and 'new_world' is set. If so, sets 'dt' to the time step since the last cycle and
+    // returns true. The caller must then call step(dt).
+    bool startCycle(double time, bool new_world, double& dt);
+
+    void step(double dt);
+
+    PluginStats stats() const;
 
 protected:
 
     class_loader::ClassLoader*  class_loader_;
 
-    PluginPtr plugin_;
+    ThreadPool& thread_pool_;
 
-    bool stop_;
+    RenderService& render_service_;
+
+    PluginPtr plugin_;
 
     // 1.0 / cycle frequency
     double cycle_duration_;
 
     double loop_frequency_;
 
-    mutable boost::mutex mutex_update_request_;
+    struct WorldStamped
+    {
+        WorldStamped(const WorldConstPtr& world_ = WorldConstPtr(), double time_ = 0) : world(world_), time(time_) {}
+        WorldConstPtr world;
+        double time;
+    };
 
-    ed::UpdateRequestPtr update_request_;
+    // Handoff from the plugin to the simulator
+    AtomicSlot<ed::UpdateRequestConstPtr> update_request_;
 
-    boost::shared_ptr<boost::thread> thread_;
+    // Request the plugin writes into during the next cycle (reused while it stays empty)
+    ed::UpdateRequestPtr update_request_next_;
 
-    bool step_finished_;
+    // Handoff from the simulator to the plugin
+    AtomicSlot<WorldStamped> world_new_;
 
-    double t_last_update_;
+    WorldStamped world_current_;
 
-    mutable boost::mutex mutex_world_;
+    bool event_driven_;
 
-    ed::WorldModelConstPtr world_new_;
+    // Set by the simulator when the cycle starts, reset by step() when it is finished
+    boost::atomic<bool> step_finished_;
+
+    // Simulated time at which the last cycle started (-1 if the plugin did not run yet)
+    double t_last_update_;
 
-    ed::WorldModelConstPtr world_current_;
+    // Simulated time at which the next cycle is due
+    double t_next_cycle_;
 
     // The object this plugin is attached to. Empty is not attached.
     LUId object_id_;
 
-    void step();
+    // Statistics
+
+    enum BlockReason
+    {
+        NOT_BLOCKED,
+        BLOCKED_BUSY,
+        BLOCKED_REQUEST_PENDING
+    };
+
+    // Why the plugin could not start the last time it was due
+    BlockReason blocked_;
+
+    // Started when the update request is handed to the simulator
+    tue::Timer timer_request_;
+
+    mutable boost::mutex mutex_stats_;
 
-    void run();
+    PluginStats stats_;
 
 };
 
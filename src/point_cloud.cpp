@@ -0,0 +1,86 @@
+#include "fast_simulator2/point_cloud.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include <cstddef>
+#include <limits>
+
+namespace sim
+{
+
+void depthToPoints(const float* depth, int width, int stride, int row_begin, int row_end,
+                   float fx, float fy, float cx, float cy, float* points)
+{
+    const float nan = std::numeric_limits<float>::quiet_NaN();
+    const float inv_fx = 1.0f / fx;
+    const float inv_fy = 1.0f / fy;
+
+    for(int y = row_begin; y < row_end; ++y)
+    {
+        const float* row = depth + y * stride;
+        float* p = points + (std::size_t)y * width * (POINT_STEP / sizeof(float));
+
+        // Same for the whole row
+        const float fy_row = (y - cy) * inv_fy;
+
+        int x = 0;
+
+#if defined(__SSE2__)
+        // Also used if AVX is available: four points of 16 bytes are exactly one 4 x 4 transpose of the
+        // x, y and z vectors
+        const __m128 v_zero = _mm_setzero_ps();
+        const __m128 v_nan = _mm_set1_ps(nan);
+        const __m128 v_cx = _mm_set1_ps(cx);
+        const __m128 v_inv_fx = _mm_set1_ps(inv_fx);
+        const __m128 v_fy_row = _mm_set1_ps(fy_row);
+        const __m128 v_four = _mm_set1_ps(4);
+
+        __m128 u = _mm_setr_ps(0, 1, 2, 3);
+        for(; x + 4 <= width; x += 4, p += 16)
+        {
+            __m128 z = _mm_loadu_ps(row + x);
+            __m128 valid = _mm_cmpneq_ps(z, v_zero);
+
+            // Same order of operations as the scalar code below, so the results are identical
+            __m128 px = _mm_mul_ps(_mm_mul_ps(_mm_sub_ps(u, v_cx), v_inv_fx), z);
+            __m128 py = _mm_mul_ps(v_fy_row, z);
+            __m128 pz = z;
+            __m128 pad = v_zero;
+
+            px = _mm_or_ps(_mm_and_ps(valid, px), _mm_andnot_ps(valid, v_nan));
+            py = _mm_or_ps(_mm_and_ps(valid, py), _mm_andnot_ps(valid, v_nan));
+            pz = _mm_or_ps(_mm_and_ps(valid, pz), _mm_andnot_ps(valid, v_nan));
+
+            // Rows become points
+            _MM_TRANSPOSE4_PS(px, py, pz, pad);
+
+            _mm_storeu_ps(p, px);
+            _mm_storeu_ps(p + 4, py);
+            _mm_storeu_ps(p + 8, pz);
+            _mm_storeu_ps(p + 12, pad);
+
+            u = _mm_add_ps(u, v_four);
+        }
+#endif
+
+        for(; x < width; ++x, p += 4)
+        {
+            float z = row[x];
+            if (z == 0)
+            {
+                p[0] = p[1] = p[2] = nan;
+            }
+            else
+            {
+                p[0] = ((x - cx) * inv_fx) * z;
+                p[1] = fy_row * z;
+                p[2] = z;
+            }
+            p[3] = 0;
+        }
+    }
+}
+
+} // end namespace sim
@@ -0,0 +1,467 @@
+#include "fast_simulator2/render_service.h"
+#include "fast_simulator2/world.h"
+#include "fast_simulator2/thread_pool.h"
+
+#include <geolib/Shape.h>
+#include <ed/entity.h>
+
+#include <boost/bind.hpp>
+
+#include <algorithm>
+
+namespace sim
+{
+
+namespace
+{
+
+// Scenes with fewer triangles are not worth splitting over multiple tasks
+const unsigned long MIN_TRIANGLES_PER_TASK = 2000;
+
+// Rotation from the camera frame (z forward) to the geolib camera frame (z backward)
+const geo::Pose3D GEOLIB_CAMERA_CORRECTION(0, 0, 0, 3.1415, 0, 0);
+
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+RenderService::RenderService(ThreadPool& pool) : pool_(pool)
+{
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+RenderService::~RenderService()
+{
+    for(std::vector<Context*>::iterator it = free_contexts_.begin(); it != free_contexts_.end(); ++it)
+        delete *it;
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+int RenderService::addView(const geo::DepthCamera& camera, const Frustum& frustum, const void* owner)
+{
+    boost::lock_guard<boost::mutex> lg(mutex_);
+
+    // Reuse the slot of a removed view, so reconfiguring does not keep growing the views
+    unsigned int view = 0;
+    while(view < views_.size() && views_[view].in_use)
+        ++view;
+
+    if (view == views_.size())
+    {
+        views_.push_back(View());
+        view_batches_.push_back(BatchPtr());
+    }
+
+    View& v = views_[view];
+    v.camera = camera;
+    v.frustum = frustum;
+    v.owner = owner;
+    v.in_use = true;
+
+    return view;
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+void RenderService::removeViews(const void* owner)
+{
+    std::vector<int> removed;
+    for(unsigned int i = 0; i < views_.size(); ++i)
+    {
+        if (views_[i].in_use && views_[i].owner == owner)
+            removed.push_back(i);
+    }
+
+    // Views that are still expected in a batch must not hold it up
+    release(removed);
+
+    boost::lock_guard<boost::mutex> lg(mutex_);
+    for(std::vector<int>::const_iterator it = removed.begin(); it != removed.end(); ++it)
+        views_[*it] = View();   // Also frees the scratch buffers
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+void RenderService::expect(const std::vector<int>& views)
+{
+    if (views.empty())
+        return;
+
+    BatchPtr batch(new Batch);
+
+    boost::lock_guard<boost::mutex> lg(mutex_);
+    for(std::vector<int>::const_iterator it = views.begin(); it != views.end(); ++it)
+    {
+        // Already expected in a batch that has not been rendered yet
+        if (view_batches_[*it])
+            continue;
+
+        view_batches_[*it] = batch;
+        ++batch->num_outstanding;
+    }
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+void RenderService::release(const std::vector<int>& views)
+{
+    std::vector<BatchPtr> complete;
+
+    {
+        boost::lock_guard<boost::mutex> lg(mutex_);
+        for(std::vector<int>::const_iterator it = views.begin(); it != views.end(); ++it)
+        {
+            BatchPtr batch = view_batches_[*it];
+            if (!batch)
+                continue;
+
+            view_batches_[*it].reset();
+
+            // If nothing was submitted, nobody is waiting for the batch
+            if (--batch->num_outstanding == 0 && !batch->requests.empty())
+                complete.push_back(batch);
+        }
+    }
+
+    for(std::vector<BatchPtr>::const_iterator it = complete.begin(); it != complete.end(); ++it)
+        finishBatch(*it);
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+void RenderService::render(int view, const World& world, const geo::Pose3D& camera_pose, const DepthBuffer& buffer,
+                           std::vector<int>* visible_entities)
+{
+    Request req;
+    req.view = view;
+    req.world = &world;
+    req.camera_pose = camera_pose;
+    req.buffer = buffer;
+    req.visible_entities = visible_entities;
+
+    if (visible_entities)
+        visible_entities->clear();
+
+    BatchPtr batch;
+    bool complete = false;
+
+    {
+        boost::lock_guard<boost::mutex> lg(mutex_);
+        batch = view_batches_[view];
+        if (batch)
+        {
+            view_batches_[view].reset();
+            batch->requests.push_back(req);
+            --batch->num_outstanding;
+
+            // The owner may render its other views after this one, but not while it waits for the batch
+            if (views_[view].owner)
+            {
+                for(unsigned int i = 0; i < views_.size(); ++i)
+                {
+                    if (view_batches_[i] == batch && views_[i].owner == views_[view].owner)
+                    {
+                        view_batches_[i].reset();
+                        --batch->num_outstanding;
+                    }
+                }
+            }
+
+            complete = (batch->num_outstanding == 0);
+        }
+    }
+
+    if (!batch)
+    {
+        // Not expected, so render right away
+        renderBatch(std::vector<Request>(1, req));
+        return;
+    }
+
+    if (complete)
+        finishBatch(batch);
+    else
+        waitForBatch(batch);
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+void RenderService::finishBatch(const BatchPtr& batch)
+{
+    // No requests are added to a batch without outstanding views, so it can be read without locking
+    renderBatch(batch->requests);
+
+    {
+        boost::lock_guard<boost::mutex> lg(mutex_);
+        batch->done = true;
+    }
+
+    pool_.notifyWaiters();
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+void RenderService::waitForBatch(const BatchPtr& batch)
+{
+    // The plugins we are waiting for may be queued in the thread pool, so help executing tasks
+    pool_.waitUntil(boost::bind(&RenderService::batchDone, this, boost::cref(batch)));
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+bool RenderService::batchDone(const BatchPtr& batch)
+{
+    boost::lock_guard<boost::mutex> lg(mutex_);
+    return batch->done;
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+void RenderService::renderBatch(const std::vector<Request>& requests)
+{
+    Context* context;
+
+    {
+        boost::lock_guard<boost::mutex> lg(mutex_);
+        if (free_contexts_.empty())
+        {
+            context = new Context;
+        }
+        else
+        {
+            context = free_contexts_.back();
+            free_contexts_.pop_back();
+        }
+    }
+
+    // Usually all requests of a batch are for the same world snapshot, but plugins that started in
+    // different steps may have different ones
+    std::vector<bool> handled(requests.size(), false);
+    std::vector<const Request*> group;
+
+    for(unsigned int i = 0; i < requests.size(); ++i)
+    {
+        if (handled[i])
+            continue;
+
+        group.clear();
+        for(unsigned int j = i; j < requests.size(); ++j)
+        {
+            if (!handled[j] && requests[j].world == requests[i].world)
+            {
+                group.push_back(&requests[j]);
+                handled[j] = true;
+            }
+        }
+
+        renderWorld(*context, group);
+    }
+
+    boost::lock_guard<boost::mutex> lg(mutex_);
+    free_contexts_.push_back(context);
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+void RenderService::renderWorld(Context& context, const std::vector<const Request*>& requests)
+{
+    const World& world = *requests.front()->world;
+
+    std::vector<Entity>& entities = context.entities;
+    std::vector<int>& entity_slots = context.entity_slots;
+
+    entities.clear();
+    entity_slots.resize(std::max<std::size_t>(entity_slots.size(), world.entityCapacity()), -1);
+
+    // - - - - - - - - - - - - - - - Culling - - - - - - - - - - - - - - -
+
+    unsigned long total_triangles = 0;
+
+    for(std::vector<const Request*>::const_iterator it = requests.begin(); it != requests.end(); ++it)
+    {
+        const Request& req = **it;
+        View& view = views_[req.view];
+
+        world.spatialIndex().query(view.frustum.transformed(req.camera_pose), context.query_result);
+
+        view.visible.clear();
+        view.num_triangles.assign(1, 0);
+
+        for(std::vector<int>::const_iterator it_idx = context.query_result.begin();
+            it_idx != context.query_result.end(); ++it_idx)
+        {
+            int& slot = entity_slots[*it_idx];
+            if (slot < 0)
+            {
+                const ed::EntityConstPtr& e = world.entity(*it_idx);
+                if (!e || !e->shape())
+                    continue;
+
+                Entity entity;
+                entity.index = *it_idx;
+
+                // Static entities are already in the world frame
+                if (world.staticGeometry().isStatic(*it_idx))
+                {
+                    entity.mesh = &world.staticGeometry().part(*it_idx)->mesh;
+                    entity.pose = geo::Pose3D::identity();
+                }
+                else
+                {
+                    entity.mesh = &e->shape()->getMesh();
+                    entity.pose = e->pose();
+                }
+
+                entity.num_triangles = entity.mesh->getTriangleIs().size();
+
+                slot = entities.size();
+                entities.push_back(entity);
+            }
+
+            view.visible.push_back(slot);
+            view.num_triangles.push_back(view.num_triangles.back() + entities[slot].num_triangles);
+
+            if (req.visible_entities)
+                req.visible_entities->push_back(*it_idx);
+        }
+
+        total_triangles += view.num_triangles.back();
+    }
+
+    // Only the slots that were set need to be reset
+    for(std::vector<Entity>::const_iterator it = entities.begin(); it != entities.end(); ++it)
+        entity_slots[it->index] = -1;
+
+    // - - - - - - - - - - - - - - - Rendering - - - - - - - - - - - - - - -
+
+    // Number of tasks over all views, each with roughly the same number of triangles
+    unsigned int num_tasks = std::max<unsigned long>(1, std::min<unsigned long>(pool_.numThreads(),
+                                                     total_triangles / MIN_TRIANGLES_PER_TASK));
+
+    TaskGroup tasks(pool_);
+
+    // Number of tasks that render into scratch buffers, per request
+    std::vector<unsigned int> num_scratch(requests.size(), 0);
+
+    for(unsigned int r = 0; r < requests.size(); ++r)
+    {
+        const Request& req = *requests[r];
+        View& view = views_[req.view];
+
+        geo::Pose3D camera_pose_inv = GEOLIB_CAMERA_CORRECTION * req.camera_pose.inverse();
+
+        unsigned long view_triangles = view.num_triangles.back();
+        unsigned int view_tasks = total_triangles == 0 ? 1 :
+                std::max<unsigned long>(1, (num_tasks * view_triangles + total_triangles / 2) / total_triangles);
+
+        // Scratch buffers are kept between batches
+        unsigned int num_pixels = req.buffer.width() * req.buffer.height();
+        while(view.depth_scratch.size() < view_tasks - 1)
+            view.depth_scratch.push_back(std::vector<float>(num_pixels));
+        if (req.buffer.hasLabels())
+        {
+            while(view.label_scratch.size() < view_tasks - 1)
+                view.label_scratch.push_back(std::vector<int>(num_pixels));
+        }
+
+        unsigned int i_begin = 0;
+        for(unsigned int t = 0; t < view_tasks; ++t)
+        {
+            // The last task takes all remaining entities
+            unsigned long triangles_end = view_triangles * (t + 1) / view_tasks;
+            unsigned int i_end = i_begin;
+            while(i_end < view.visible.size() && (view.num_triangles[i_end] < triangles_end || t + 1 == view_tasks))
+                ++i_end;
+
+            DepthBuffer target = req.buffer;
+            if (t > 0)
+            {
+                view.depth_scratch[t - 1].resize(num_pixels);
+                int* labels = 0;
+                if (req.buffer.hasLabels())
+                {
+                    view.label_scratch[t - 1].resize(num_pixels);
+                    labels = &view.label_scratch[t - 1][0];
+                }
+
+                target = DepthBuffer(&view.depth_scratch[t - 1][0], labels, req.buffer.width(), req.buffer.height(),
+                                     req.buffer.width());
+            }
+
+            tasks.run(boost::bind(&RenderService::renderTask, this, &context, boost::cref(req), camera_pose_inv,
+                                  i_begin, i_end, target, t > 0));
+            i_begin = i_end;
+        }
+
+        num_scratch[r] = view_tasks - 1;
+    }
+
+    tasks.wait();
+
+    // - - - - - - - - - - - - - - - Merging - - - - - - - - - - - - - - -
+
+    for(unsigned int r = 0; r < requests.size(); ++r)
+    {
+        if (num_scratch[r] == 0)
+            continue;
+
+        // Merge the partial images, keeping the minimum depth of each pixel
+        int height = requests[r]->buffer.height();
+        int rows_per_task = (height + num_scratch[r]) / (num_scratch[r] + 1);
+        for(int row = 0; row < height; row += rows_per_task)
+            tasks.run(boost::bind(&RenderService::mergeTask, this, boost::cref(*requests[r]), num_scratch[r], row,
+                                  std::min(row + rows_per_task, height)));
+    }
+
+    tasks.wait();
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+void RenderService::renderTask(const Context* context, const Request& req, const geo::Pose3D& camera_pose_inv,
+                               unsigned int i_begin, unsigned int i_end, DepthBuffer buffer, bool clear)
+{
+    if (clear)
+    {
+        for(int y = 0; y < buffer.height(); ++y)
+        {
+            std::fill(buffer.row(y), buffer.row(y) + buffer.width(), 0.0f);
+            if (buffer.hasLabels())
+                std::fill(buffer.labelRow(y), buffer.labelRow(y) + buffer.width(), 0);
+        }
+    }
+
+    const View& view = views_[req.view];
+
+    DepthBufferRenderResult res(buffer);
+
+    for(unsigned int i = i_begin; i < i_end; ++i)
+    {
+        const Entity& entity = context->entities[view.visible[i]];
+
+        geo::RenderOptions opt;
+        opt.setMesh(*entity.mesh, camera_pose_inv * entity.pose);
+
+        res.setLabel(entity.index + 1);
+        view.camera.render(opt, res);
+    }
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+void RenderService::mergeTask(const Request& req, unsigned int num_buffers, int row_begin, int row_end)
+{
+    View& view = views_[req.view];
+    DepthBuffer buffer = req.buffer;
+
+    for(unsigned int i = 0; i < num_buffers; ++i)
+    {
+        int* labels = buffer.hasLabels() ? &view.label_scratch[i][0] : 0;
+        buffer.merge(DepthBuffer(&view.depth_scratch[i][0], labels, buffer.width(), buffer.height(), buffer.width()),
+                     row_begin, row_end);
+    }
+}
+
+} // end namespace sim
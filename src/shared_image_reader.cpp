@@ -0,0 +1,98 @@
+// ----------------------------------------------------------------------------------------------------
+//
+// Stand-in consumer of a shared memory image ring (see shared_image_ring.h), for testing. Attaches to
+// the ring, waits for frames and prints once per second how many frames were received, skipped (the
+// reader was too slow) and overwritten while being read, plus the depth of the center pixel.
+//
+// Usage: sim2_shm_reader RING_NAME [processing time per frame in ms]
+//
+// ----------------------------------------------------------------------------------------------------
+
+#include "fast_simulator2/shared_image_ring.h"
+
+#include <boost/thread/thread.hpp>
+
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+// ----------------------------------------------------------------------------------------------------
+
+int main(int argc, char **argv)
+{
+    if (argc < 2)
+    {
+        std::cerr << "Usage: sim2_shm_reader RING_NAME [processing time per frame in ms]" << std::endl;
+        return 1;
+    }
+
+    std::string name = argv[1];
+    int processing_time = argc > 2 ? atoi(argv[2]) : 0;
+
+    sim::SharedImageRing ring;
+    uint64_t last_sequence = 0;
+
+    unsigned long num_received = 0, num_skipped = 0, num_overwritten = 0;
+    float center_depth = 0;
+
+    boost::posix_time::ptime t_report = boost::posix_time::microsec_clock::universal_time();
+
+    while(true)
+    {
+        if (!ring.isOpen())
+        {
+            std::string error;
+            if (!ring.open(name, error))
+            {
+                std::cerr << error << ", retrying" << std::endl;
+                boost::this_thread::sleep(boost::posix_time::seconds(1));
+                continue;
+            }
+
+            std::cout << "Attached to '" << name << "': " << ring.width() << " x " << ring.height() << " "
+                      << ring.encoding() << ", " << ring.numSlots() << " slots" << std::endl;
+            last_sequence = 0;
+        }
+
+        sim::SharedFrameDescriptor frame;
+        if (!ring.waitForFrame(last_sequence, 2.0, frame))
+        {
+            // The writer may have restarted (and created a new ring), so attach again
+            std::cerr << "No frames received, re-attaching" << std::endl;
+            ring.close();
+            continue;
+        }
+
+        if (last_sequence > 0)
+            num_skipped += frame.sequence - last_sequence - 1;
+        last_sequence = frame.sequence;
+
+        // Read the image in place
+        const unsigned char* data = ring.data(frame);
+        if (ring.encoding() == "32FC1")
+        {
+            const unsigned char* center = data + (ring.height() / 2) * ring.step() + (ring.width() / 2) * sizeof(float);
+            std::memcpy(&center_depth, center, sizeof(float));
+        }
+
+        if (processing_time > 0)
+            boost::this_thread::sleep(boost::posix_time::milliseconds(processing_time));
+
+        // Only use the results if the writer did not overwrite the frame in the meantime
+        if (ring.isValid(frame))
+            ++num_received;
+        else
+            ++num_overwritten;
+
+        boost::posix_time::ptime now = boost::posix_time::microsec_clock::universal_time();
+        if (now - t_report >= boost::posix_time::seconds(1))
+        {
+            std::cout << "stamp " << frame.stamp << ": " << num_received << " frames, " << num_skipped
+                      << " skipped, " << num_overwritten << " overwritten, center depth " << center_depth << std::endl;
+            num_received = num_skipped = num_overwritten = 0;
+            t_report = now;
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,325 @@
+#include "fast_simulator2/shared_image_ring.h"
+
+#include <boost/interprocess/sync/interprocess_mutex.hpp>
+#include <boost/interprocess/sync/interprocess_condition.hpp>
+#include <boost/interprocess/sync/scoped_lock.hpp>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+#include <boost/date_time/gregorian/gregorian_types.hpp>
+
+#include <algorithm>
+#include <cstring>
+#include <new>
+
+namespace ipc = boost::interprocess;
+
+namespace sim
+{
+
+namespace
+{
+
+const uint32_t MAGIC = 0x53494d52;  // "SIMR"
+const uint32_t VERSION = 2;
+
+const unsigned int MAX_NUM_SLOTS = 64;
+
+// Slots start at cache line boundaries
+const uint64_t ALIGNMENT = 64;
+
+uint64_t align(uint64_t size)
+{
+    return (size + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+}
+
+typedef ipc::scoped_lock<ipc::interprocess_mutex> Lock;
+
+// Waiting readers renew their heartbeat at least this often (must be well below READER_TIMEOUT)
+const double HEARTBEAT_INTERVAL = 0.1;
+
+// Wall-clock time in microseconds, which is the same for all processes on the machine
+int64_t now()
+{
+    static const boost::posix_time::ptime epoch(boost::gregorian::date(1970, 1, 1));
+    return (boost::posix_time::microsec_clock::universal_time() - epoch).total_microseconds();
+}
+
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+const double SharedImageRing::READER_TIMEOUT = 1.0;
+
+// ----------------------------------------------------------------------------------------------------
+
+// Lives at the start of the shared memory, followed by the slots. Only contains plain data and
+// process-shared primitives, so it can be mapped at different addresses in different processes.
+struct SharedImageRing::Header
+{
+    uint32_t magic;
+    uint32_t version;
+
+    int32_t width, height, step;
+    char encoding[32];
+
+    uint32_t num_slots;
+    uint64_t slot_size;
+
+    // Everything below is protected by the mutex
+
+    ipc::interprocess_mutex mutex;
+    ipc::interprocess_condition frame_available;
+
+    // Last time (see now()) a reader was active
+    int64_t reader_heartbeat;
+
+    // Most recently committed frame
+    SharedFrameDescriptor latest;
+
+    // Sequence number of the frame in each slot (0 while being written)
+    uint64_t slot_sequence[MAX_NUM_SLOTS];
+};
+
+// ----------------------------------------------------------------------------------------------------
+
+SharedImageRing::SharedImageRing() : is_writer_(false), header_(0), slots_(0), write_slot_(0)
+{
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+SharedImageRing::~SharedImageRing()
+{
+    close();
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+void SharedImageRing::close()
+{
+    if (!header_)
+        return;
+
+    // Readers that are still attached keep their mapping; they will time out and re-open
+    if (is_writer_)
+        ipc::shared_memory_object::remove(name_.c_str());
+
+    region_ = ipc::mapped_region();
+    shm_ = ipc::shared_memory_object();
+    header_ = 0;
+    slots_ = 0;
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+bool SharedImageRing::create(const std::string& name, int width, int height, int bytes_per_pixel,
+                             const std::string& encoding, unsigned int num_slots, std::string& error)
+{
+    close();
+
+    if (width <= 0 || height <= 0 || bytes_per_pixel <= 0)
+    {
+        error = "Invalid image size";
+        return false;
+    }
+
+    if (num_slots < 2 || num_slots > MAX_NUM_SLOTS)
+    {
+        error = "Number of slots must be between 2 and 64";
+        return false;
+    }
+
+    if (encoding.size() >= sizeof(Header().encoding))
+    {
+        error = "Encoding name too long";
+        return false;
+    }
+
+    uint64_t step = (uint64_t)width * bytes_per_pixel;
+    uint64_t slot_size = align(step * height);
+    uint64_t total_size = align(sizeof(Header)) + num_slots * slot_size;
+
+    try
+    {
+        // A previous writer may have crashed without cleaning up
+        ipc::shared_memory_object::remove(name.c_str());
+
+        shm_ = ipc::shared_memory_object(ipc::create_only, name.c_str(), ipc::read_write);
+        shm_.truncate(total_size);
+        region_ = ipc::mapped_region(shm_, ipc::read_write);
+    }
+    catch (const ipc::interprocess_exception& e)
+    {
+        error = "Could not create shared memory '" + name + "': " + e.what();
+        return false;
+    }
+
+    name_ = name;
+    is_writer_ = true;
+    write_slot_ = 0;
+
+    unsigned char* base = static_cast<unsigned char*>(region_.get_address());
+    header_ = new (base) Header;
+    header_->width = width;
+    header_->height = height;
+    header_->step = step;
+    std::strncpy(header_->encoding, encoding.c_str(), sizeof(header_->encoding) - 1);
+    header_->encoding[sizeof(header_->encoding) - 1] = '\0';
+    header_->num_slots = num_slots;
+    header_->slot_size = slot_size;
+    header_->reader_heartbeat = 0;
+    header_->latest = SharedFrameDescriptor();
+    for(unsigned int i = 0; i < MAX_NUM_SLOTS; ++i)
+        header_->slot_sequence[i] = 0;
+
+    slots_ = base + align(sizeof(Header));
+
+    // Set last: readers do not attach before the header is initialized
+    header_->version = VERSION;
+    __sync_synchronize();
+    header_->magic = MAGIC;
+
+    return true;
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+bool SharedImageRing::open(const std::string& name, std::string& error)
+{
+    close();
+
+    try
+    {
+        shm_ = ipc::shared_memory_object(ipc::open_only, name.c_str(), ipc::read_write);
+        region_ = ipc::mapped_region(shm_, ipc::read_write);
+    }
+    catch (const ipc::interprocess_exception& e)
+    {
+        error = "Could not open shared memory '" + name + "': " + e.what();
+        region_ = ipc::mapped_region();
+        shm_ = ipc::shared_memory_object();
+        return false;
+    }
+
+    unsigned char* base = static_cast<unsigned char*>(region_.get_address());
+    Header* header = reinterpret_cast<Header*>(base);
+
+    if (region_.get_size() < sizeof(Header) || header->magic != MAGIC || header->version != VERSION
+            || region_.get_size() < align(sizeof(Header)) + header->num_slots * header->slot_size)
+    {
+        error = "Shared memory '" + name + "' is not (yet) a valid image ring";
+        region_ = ipc::mapped_region();
+        shm_ = ipc::shared_memory_object();
+        return false;
+    }
+
+    name_ = name;
+    is_writer_ = false;
+    header_ = header;
+    slots_ = base + align(sizeof(Header));
+
+    Lock lock(header_->mutex);
+    header_->reader_heartbeat = now();
+
+    return true;
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+int SharedImageRing::width() const { return header_->width; }
+
+int SharedImageRing::height() const { return header_->height; }
+
+int SharedImageRing::step() const { return header_->step; }
+
+std::string SharedImageRing::encoding() const { return header_->encoding; }
+
+unsigned int SharedImageRing::numSlots() const { return header_->num_slots; }
+
+// ----------------------------------------------------------------------------------------------------
+
+bool SharedImageRing::hasReaders() const
+{
+    Lock lock(header_->mutex);
+    return now() - header_->reader_heartbeat < (int64_t)(READER_TIMEOUT * 1e6);
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+unsigned char* SharedImageRing::beginWrite()
+{
+    write_slot_ = (header_->latest.slot + 1) % header_->num_slots;
+
+    {
+        Lock lock(header_->mutex);
+        header_->slot_sequence[write_slot_] = 0;
+    }
+
+    return slots_ + write_slot_ * header_->slot_size;
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+SharedFrameDescriptor SharedImageRing::commit(double stamp)
+{
+    SharedFrameDescriptor frame;
+    frame.slot = write_slot_;
+    frame.stamp = stamp;
+
+    {
+        Lock lock(header_->mutex);
+        frame.sequence = header_->latest.sequence + 1;
+        header_->slot_sequence[write_slot_] = frame.sequence;
+        header_->latest = frame;
+    }
+
+    header_->frame_available.notify_all();
+
+    return frame;
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+bool SharedImageRing::waitForFrame(uint64_t sequence, double timeout, SharedFrameDescriptor& frame) const
+{
+    boost::posix_time::ptime deadline = boost::posix_time::microsec_clock::universal_time()
+            + boost::posix_time::microseconds((long)(timeout * 1e6));
+
+    Lock lock(header_->mutex);
+    header_->reader_heartbeat = now();
+
+    while(header_->latest.sequence <= sequence)
+    {
+        // Wake up regularly to renew the heartbeat: the writer may not write frames without readers
+        boost::posix_time::ptime wakeup = std::min(deadline, boost::posix_time::microsec_clock::universal_time()
+                + boost::posix_time::microseconds((long)(HEARTBEAT_INTERVAL * 1e6)));
+
+        if (!header_->frame_available.timed_wait(lock, wakeup) && header_->latest.sequence <= sequence)
+        {
+            if (boost::posix_time::microsec_clock::universal_time() >= deadline)
+                return false;
+        }
+
+        header_->reader_heartbeat = now();
+    }
+
+    frame = header_->latest;
+    return true;
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+const unsigned char* SharedImageRing::data(const SharedFrameDescriptor& frame) const
+{
+    return slots_ + frame.slot * header_->slot_size;
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+bool SharedImageRing::isValid(const SharedFrameDescriptor& frame) const
+{
+    Lock lock(header_->mutex);
+    header_->reader_heartbeat = now();
+    return frame.slot < header_->num_slots && header_->slot_sequence[frame.slot] == frame.sequence;
+}
+
+} // end namespace sim
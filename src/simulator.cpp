@@ -2,6 +2,7 @@
 
 // Plugin loading
 #include "fast_simulator2/plugin.h"
+#include <boost/bind.hpp>
 #include "plugin_container.h"
 #include <tue/filesystem/path.h>
 
@@ -9,20 +10,26 @@
 #include <tue/config/loaders/yaml.h>
 #include <ed/update_request.h>
 #include <ed/relation.h>
+#include <ed/entity.h>
 
-#include <ed/world_model.h>
+#include "fast_simulator2/world.h"
 #include <ed/relations/transform_cache.h>
 
+// Statistics
+#include <tue/profiling/timer.h>
+
 // Loading model files
 #include <ros/package.h>
 #include <fstream>
+#include <algorithm>
 
 namespace sim
 {
 
 // ----------------------------------------------------------------------------------------------------
 
-Simulator::Simulator() : world_(new ed::WorldModel())
+Simulator::Simulator() : world_(new World()), time_(0), lockstep_(false), plugin_tasks_(thread_pool_),
+    render_service_(thread_pool_), world_changed_(true)
 {
     model_path_ = ros::package::getPath("fast_simulator2") + "/models";
 }
@@ -31,6 +38,9 @@ Simulator::Simulator() : world_(new ed::WorldModel())
 
 Simulator::~Simulator()
 {
+    // Wait for the plugins that are still running
+    plugin_tasks_.wait();
+
     // Stop all plugins
     for(std::map<std::string, PluginContainerPtr>::iterator it = plugin_containers_.begin(); it != plugin_containers_.end(); ++it)
     {
@@ -115,6 +125,12 @@ void Simulator::createObject(LUId parent_id, tue::Configuration config, ed::Upda
         type == "_UNKNOWN_";
     req.setType(id, type);
 
+    // Objects that never move (walls, furniture) can be marked static, so that sensors use their cached
+    // world-frame geometry right away (see World::staticGeometry())
+    int is_static;
+    if (config.value("static", is_static, tue::OPTIONAL) && is_static)
+        static_ids_.push_back(id);
+
     // Optionally set another parent
     if (config.value("parent", parent_id.id, tue::OPTIONAL))
         req.setType(parent_id.id, "_UNKNOWN_");
@@ -160,6 +176,15 @@ void Simulator::createObject(LUId parent_id, tue::Configuration config, ed::Upda
                 plugin_cfg.setValue("_object", id);
                 plugin_cfg.data().add(params.data());
 
+                // Optional plugin rate (in simulated time)
+                double frequency;
+                if (config.value("frequency", frequency, tue::OPTIONAL))
+                    plugin_cfg.setValue("_frequency", frequency);
+
+                int event_driven;
+                if (config.value("event_driven", event_driven, tue::OPTIONAL))
+                    plugin_cfg.setValue("_event_driven", event_driven);
+
                 std::string load_error;
                 loadPlugin(id + "-" + lib_filename, lib_filename, plugin_cfg, load_error);
 
@@ -188,8 +213,16 @@ void Simulator::createObject(LUId parent_id, tue::Configuration config, ed::Upda
 
 void Simulator::configure(tue::Configuration config)
 {
+    // Configuring can add and replace plugins (and their render views), which may not happen while
+    // plugins are running
+    plugin_tasks_.wait();
+
     ed::UpdateRequest req;
 
+    int lockstep;
+    if (config.value("lockstep", lockstep, tue::OPTIONAL))
+        lockstep_ = lockstep;
+
     if (config.readArray("models"))
     {
         while (config.nextArrayItem())
@@ -218,54 +251,179 @@ void Simulator::configure(tue::Configuration config)
 
     if (!req.empty())
     {
-        ed::WorldModelPtr world_updated = boost::make_shared<ed::WorldModel>(*world_);   // Create a world copy
+        WorldPtr world_updated = boost::make_shared<World>(*world_);   // Create a world copy (shares all structure)
         world_updated->update(req);
+
+        // Objects created from models consist of several entities, with ids '<object id>/...'. So an
+        // entity is static if its id, or its id up to one of its slashes, is a static id.
+        std::vector<UUId> static_entities;
+        if (!static_ids_.empty())
+        {
+            std::sort(static_ids_.begin(), static_ids_.end());
+
+            for(World::const_iterator it = world_updated->begin(); it != world_updated->end(); ++it)
+            {
+                const std::string& id = (*it)->id().str();
+
+                bool is_static = std::binary_search(static_ids_.begin(), static_ids_.end(), id);
+                for(std::size_t i = id.find('/'); !is_static && i != std::string::npos; i = id.find('/', i + 1))
+                    is_static = std::binary_search(static_ids_.begin(), static_ids_.end(), id.substr(0, i));
+
+                if (is_static)
+                    static_entities.push_back(id);
+            }
+
+            world_updated->markStatic(static_entities);
+        }
         world_ = world_updated;
+        world_changed_ = true;
     }
+
+    static_ids_.clear();
 }
 
 // ----------------------------------------------------------------------------------------------------
 
 void Simulator::step(double dt)
 {
-    ed::WorldModelPtr world_updated;
+    if (lockstep_)
+    {
+        // Let all plugins that are due process the current world in parallel, and wait for them
+        startPlugins(world_changed_);
+        plugin_tasks_.wait();
+        world_changed_ = mergeUpdateRequests();
+    }
+    else
+    {
+        // Merge the requests of the plugins that finished since the last step, and start the plugins
+        // that are due (unless they are still busy with their previous cycle). Plugins that were
+        // waiting for their request to be merged are started right away. The world may also have
+        // changed by (re)configuration.
+        bool world_changed = mergeUpdateRequests();
+        startPlugins(world_changed_ || world_changed);
+        world_changed_ = false;
+    }
+
+    time_ += dt;
+}
+
+// ----------------------------------------------------------------------------------------------------
 
-    // collect all update requests
-    std::vector<PluginContainerPtr> plugins_with_requests;
+void Simulator::startPlugins(bool world_changed)
+{
     for(std::map<std::string, PluginContainerPtr>::iterator it = plugin_containers_.begin(); it != plugin_containers_.end(); ++it)
     {
         const PluginContainerPtr& c = it->second;
 
-        if (c->updateRequest())
+        double dt;
+        if (c->startCycle(time_, world_changed, dt))
         {
-            if (!world_updated)
-                world_updated = boost::make_shared<ed::WorldModel>(*world_);   // Create a world copy
-
-            const ed::UpdateRequestConstPtr& req = c->updateRequest();
-            if (req)
+            // The plugins query poses at the time they are started with, so calculate the poses of all
+            // entities once (at most once per snapshot and time) instead of per query. Like in lockstep
+            // mode, this thread helps with pending tasks of the pool while waiting for the pose tasks.
+            if (started_plugins_.empty())
             {
-                world_updated->update(*req);
-                plugins_with_requests.push_back(c);
+                tue::Timer timer_poses;
+                timer_poses.start();
+                world_->preparePoses(time_, &thread_pool_);
+                timer_poses.stop();
+                stats_.poses_time.add(timer_poses.getElapsedTimeInSec());
             }
+
+            // Only plugins that start get the current world; the others get it when they are due
+            c->setWorld(world_, time_);
+            started_plugins_.push_back(std::make_pair(c, dt));
+            due_render_views_.insert(due_render_views_.end(), c->renderViews().begin(), c->renderViews().end());
         }
     }
 
-    if (world_updated)
-        world_ = world_updated; // Swap to updated world (if something changed)
+    // The cameras of all plugins that start now are rendered as one batch, so the render service
+    // must know about them before any of the plugins runs
+    render_service_.expect(due_render_views_);
 
-    // Set the new (updated) world
+    for(std::vector<std::pair<PluginContainerPtr, double> >::const_iterator it = started_plugins_.begin();
+        it != started_plugins_.end(); ++it)
+        plugin_tasks_.run(boost::bind(&PluginContainer::step, it->first, it->second));
+
+    started_plugins_.clear();
+    due_render_views_.clear();
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+bool Simulator::mergeUpdateRequests()
+{
+    // The containers are ordered by name, so the merge order (and therefore the resulting world)
+    // does not depend on thread timing
+    WorldPtr world_updated;
+    tue::Timer timer_merge;
     for(std::map<std::string, PluginContainerPtr>::iterator it = plugin_containers_.begin(); it != plugin_containers_.end(); ++it)
     {
         const PluginContainerPtr& c = it->second;
-        c->setWorld(world_);
+
+        // Taking the request flags the plugin to continue processing
+        ed::UpdateRequestConstPtr req;
+        if (c->takeUpdateRequest(req))
+        {
+            if (!world_updated)
+            {
+                tue::Timer timer_copy;
+                timer_copy.start();
+                world_updated = boost::make_shared<World>(*world_);   // Create a world copy (shares all structure)
+                timer_copy.stop();
+                stats_.world_copy_time.add(timer_copy.getElapsedTimeInSec());
+
+                timer_merge.start();
+            }
+
+            world_updated->update(*req);
+        }
     }
 
-    // Clear the requests of all plugins that had requests (which flags them to continue processing)
-    for(std::vector<PluginContainerPtr>::iterator it = plugins_with_requests.begin(); it != plugins_with_requests.end(); ++it)
+    if (!world_updated)
+        return false;
+
+    timer_merge.stop();
+    stats_.merge_time.add(timer_merge.getElapsedTimeInSec());
+
+    world_ = world_updated; // Swap to updated world
+    return true;
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+PluginContainerPtr Simulator::addPlugin(const std::string plugin_name, const PluginPtr& plugin, tue::Configuration config,
+                                        std::string& error)
+{
+    plugin_tasks_.wait();
+
+    PluginContainerPtr container(new PluginContainer(thread_pool_, render_service_));
+    if (container->setPlugin(plugin_name, plugin, config))
     {
-        PluginContainerPtr c = *it;
-        c->clearUpdateRequest();
+        plugin_containers_[plugin_name] = container;
+        return container;
     }
+
+    error += "Could not configure plugin '" + plugin_name + "'.";
+    return PluginContainerPtr();
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+PluginPtr Simulator::plugin(const std::string& name) const
+{
+    std::map<std::string, PluginContainerPtr>::const_iterator it = plugin_containers_.find(name);
+    if (it == plugin_containers_.end())
+        return PluginPtr();
+    return it->second->plugin();
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+void Simulator::getPluginStats(std::map<std::string, PluginStats>& stats) const
+{
+    for(std::map<std::string, PluginContainerPtr>::const_iterator it = plugin_containers_.begin(); it != plugin_containers_.end(); ++it)
+        stats[it->first] = it->second->stats();
 }
 
 // ----------------------------------------------------------------------------------------------------
@@ -309,11 +467,13 @@ PluginContainerPtr Simulator::loadPlugin(const std::string plugin_name, const st
         return PluginContainerPtr();
     }
 
-    PluginContainerPtr container(new PluginContainer());
+    // See configure()
+    plugin_tasks_.wait();
+
+    PluginContainerPtr container(new PluginContainer(thread_pool_, render_service_));
     if (container->loadPlugin(plugin_name, full_lib_file, config, error))
     {
         plugin_containers_[plugin_name] = container;
-        container->runThreaded();
         return container;
     }
 
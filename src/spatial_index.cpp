@@ -0,0 +1,516 @@
+#include "fast_simulator2/spatial_index.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace sim
+{
+
+namespace
+{
+
+// Number of buckets the grid cells are hashed into (must be a power of two)
+const unsigned int NUM_BUCKETS = 4096;
+
+// Entities overlapping more cells than this are stored in the 'large' list instead of the grid
+const unsigned long MAX_CELLS_PER_ENTRY = 64;
+
+typedef boost::shared_ptr<const std::vector<int> > IndexListConstPtr;
+
+IndexListConstPtr withIndex(const IndexListConstPtr& list, int idx)
+{
+    boost::shared_ptr<std::vector<int> > new_list(new std::vector<int>(*list));
+    new_list->push_back(idx);
+    return new_list;
+}
+
+IndexListConstPtr withoutIndex(const IndexListConstPtr& list, int idx)
+{
+    boost::shared_ptr<std::vector<int> > new_list(new std::vector<int>);
+    for(std::vector<int>::const_iterator it = list->begin(); it != list->end(); ++it)
+    {
+        if (*it != idx)
+            new_list->push_back(*it);
+    }
+    return new_list;
+}
+
+struct BoxQuery
+{
+    BoxQuery(const BoundingBox& box_) : box(box_) {}
+    bool operator()(const BoundingBox& b) const { return box.intersects(b); }
+    const BoundingBox& box;
+};
+
+// Query for any volume with an intersects(BoundingBox) test
+template<typename Volume>
+struct VolumeQuery
+{
+    VolumeQuery(const Volume& volume_) : volume(volume_) {}
+    bool operator()(const BoundingBox& b) const { return volume.intersects(b); }
+    const Volume& volume;
+};
+
+BoundingBox intersection(const BoundingBox& a, const BoundingBox& b)
+{
+    return BoundingBox(geo::Vec3(std::max(a.min.x, b.min.x), std::max(a.min.y, b.min.y), std::max(a.min.z, b.min.z)),
+                       geo::Vec3(std::min(a.max.x, b.max.x), std::min(a.max.y, b.max.y), std::min(a.max.z, b.max.z)));
+}
+
+// Extent of the box along 'n' (half the length of its projection onto n)
+double projectedHalfExtent(const BoundingBox& box, const geo::Vec3& n)
+{
+    geo::Vec3 half = (box.max - box.min) * 0.5;
+    return std::abs(n.x) * half.x + std::abs(n.y) * half.y + std::abs(n.z) * half.z;
+}
+
+}
+
+// ----------------------------------------------------------------------------------------------------
+//
+//                                            BOUNDING BOX
+//
+// ----------------------------------------------------------------------------------------------------
+
+void BoundingBox::add(const geo::Vec3& p)
+{
+    min.x = std::min(min.x, p.x); max.x = std::max(max.x, p.x);
+    min.y = std::min(min.y, p.y); max.y = std::max(max.y, p.y);
+    min.z = std::min(min.z, p.z); max.z = std::max(max.z, p.z);
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+void BoundingBox::add(const BoundingBox& b)
+{
+    if (b.empty())
+        return;
+
+    add(b.min);
+    add(b.max);
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+BoundingBox BoundingBox::transformed(const geo::Pose3D& pose) const
+{
+    if (empty())
+        return BoundingBox();
+
+    geo::Vec3 center = pose * ((min + max) * 0.5);
+    geo::Vec3 half = (max - min) * 0.5;
+
+    // Extent of the rotated box along each world axis
+    double e[3];
+    for(int i = 0; i < 3; ++i)
+    {
+        geo::Vec3 row = pose.R.getRow(i);
+        e[i] = std::abs(row.x) * half.x + std::abs(row.y) * half.y + std::abs(row.z) * half.z;
+    }
+
+    geo::Vec3 extent(e[0], e[1], e[2]);
+    return BoundingBox(center - extent, center + extent);
+}
+
+// ----------------------------------------------------------------------------------------------------
+//
+//                                           SPHERE AND SLAB
+//
+// ----------------------------------------------------------------------------------------------------
+
+bool Sphere::intersects(const BoundingBox& box) const
+{
+    if (box.empty())
+        return false;
+
+    // Squared distance from the center to the closest point of the box
+    double d2 = 0;
+    double c[3] = { center.x, center.y, center.z };
+    double b_min[3] = { box.min.x, box.min.y, box.min.z };
+    double b_max[3] = { box.max.x, box.max.y, box.max.z };
+    for(int i = 0; i < 3; ++i)
+    {
+        double d = std::max(0.0, std::max(b_min[i] - c[i], c[i] - b_max[i]));
+        d2 += d * d;
+    }
+
+    return d2 <= radius * radius;
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+BoundingBox Sphere::bounds() const
+{
+    geo::Vec3 r(radius, radius, radius);
+    return BoundingBox(center - r, center + r);
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+bool Slab::intersects(const BoundingBox& box) const
+{
+    if (box.empty())
+        return false;
+
+    // Distance of the box center to the plane, minus the extent of the box towards the plane
+    geo::Vec3 box_center = (box.min + box.max) * 0.5;
+    if (std::abs(normal.dot(box_center - center)) > half_thickness + projectedHalfExtent(box, normal))
+        return false;
+
+    return !bounded() || Sphere(center, radius).intersects(box);
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+BoundingBox Slab::bounds() const
+{
+    return Sphere(center, radius).bounds();
+}
+
+// ----------------------------------------------------------------------------------------------------
+//
+//                                              FRUSTUM
+//
+// ----------------------------------------------------------------------------------------------------
+
+void Frustum::addPlane(const geo::Vec3& normal, double offset)
+{
+    if (num_planes_ < MAX_PLANES)
+        planes_[num_planes_++] = Plane(normal, offset);
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+Frustum Frustum::transformed(const geo::Pose3D& pose) const
+{
+    Frustum f;
+    for(unsigned int i = 0; i < num_planes_; ++i)
+    {
+        geo::Vec3 n = pose.R * planes_[i].normal;
+        f.addPlane(n, planes_[i].offset + n.dot(pose.t));
+    }
+
+    if (bounded_)
+        f.setBounds(bounds_.transformed(pose));
+
+    return f;
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+bool Frustum::intersects(const BoundingBox& box) const
+{
+    if (box.empty())
+        return false;
+
+    for(unsigned int i = 0; i < num_planes_; ++i)
+    {
+        const geo::Vec3& n = planes_[i].normal;
+
+        // Corner of the box that lies furthest in the direction of the plane normal
+        geo::Vec3 p(n.x >= 0 ? box.max.x : box.min.x,
+                    n.y >= 0 ? box.max.y : box.min.y,
+                    n.z >= 0 ? box.max.z : box.min.z);
+
+        if (n.dot(p) < planes_[i].offset)
+            return false;
+    }
+
+    return true;
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+Frustum Frustum::camera(double tan_left, double tan_right, double tan_top, double tan_bottom,
+                        double near, double far)
+{
+    Frustum f;
+    f.addPlane(geo::Vec3(1, 0, tan_left), 0);
+    f.addPlane(geo::Vec3(-1, 0, tan_right), 0);
+    f.addPlane(geo::Vec3(0, 1, tan_top), 0);
+    f.addPlane(geo::Vec3(0, -1, tan_bottom), 0);
+    f.addPlane(geo::Vec3(0, 0, 1), near);
+
+    if (far > 0)
+    {
+        f.addPlane(geo::Vec3(0, 0, -1), -far);
+
+        // The far plane is the widest part
+        f.setBounds(BoundingBox(geo::Vec3(-tan_left * far, -tan_top * far, std::min(near, far)),
+                                geo::Vec3(tan_right * far, tan_bottom * far, far)));
+    }
+
+    return f;
+}
+
+// ----------------------------------------------------------------------------------------------------
+//
+//                                           SPATIAL INDEX
+//
+// ----------------------------------------------------------------------------------------------------
+
+unsigned long SpatialIndex::CellRange::numCells() const
+{
+    unsigned long n = 1;
+    for(int i = 0; i < 3; ++i)
+    {
+        if (max[i] < min[i])
+            return 0;
+        n *= (max[i] - min[i] + 1);
+    }
+    return n;
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+bool SpatialIndex::CellRange::operator==(const CellRange& r) const
+{
+    for(int i = 0; i < 3; ++i)
+    {
+        if (min[i] != r.min[i] || max[i] != r.max[i])
+            return false;
+    }
+    return true;
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+SpatialIndex::SpatialIndex(double cell_size) : cell_size_(cell_size), num_entries_(0),
+    large_(new std::vector<int>)
+{
+    IndexListConstPtr empty_bucket(new std::vector<int>);
+    for(unsigned int i = 0; i < NUM_BUCKETS; ++i)
+        buckets_.push_back(empty_bucket);
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+void SpatialIndex::set(int idx, const BoundingBox& box)
+{
+    if (box.empty())
+    {
+        remove(idx);
+        return;
+    }
+
+    while(entries_.size() <= (unsigned int)idx)
+        entries_.push_back(Entry());
+
+    const Entry& old = entries_[idx];
+
+    Entry e;
+    e.box = box;
+    e.cells = cellRange(box);
+    e.valid = true;
+    e.large = e.cells.numCells() > MAX_CELLS_PER_ENTRY;
+
+    // Only touch the grid if the entity moved to other cells
+    if (!old.valid || old.large != e.large || !(old.cells == e.cells))
+    {
+        if (old.valid)
+            removeFromCells(idx, old);
+        else
+            ++num_entries_;
+
+        addToCells(idx, e);
+    }
+
+    entries_.set(idx, e);
+    extent_.add(box);
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+void SpatialIndex::remove(int idx)
+{
+    if ((unsigned int)idx >= entries_.size() || !entries_[idx].valid)
+        return;
+
+    removeFromCells(idx, entries_[idx]);
+    entries_.set(idx, Entry());
+    --num_entries_;
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+bool SpatialIndex::bounds(int idx, BoundingBox& box) const
+{
+    if ((unsigned int)idx >= entries_.size() || !entries_[idx].valid)
+        return false;
+
+    box = entries_[idx].box;
+    return true;
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+void SpatialIndex::query(const BoundingBox& box, std::vector<int>& indices) const
+{
+    indices.clear();
+
+    BoundingBox clipped = intersection(box, extent_);
+    if (clipped.empty())
+        return;
+
+    queryCells(cellRange(clipped), BoxQuery(box), indices);
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+void SpatialIndex::query(const Frustum& frustum, std::vector<int>& indices) const
+{
+    indices.clear();
+
+    // Only the cells within the bounds of the frustum (e.g. up to the far plane) need to be visited
+    BoundingBox clipped = frustum.bounded() ? intersection(frustum.bounds(), extent_) : extent_;
+    if (clipped.empty())
+        return;
+
+    queryCells(cellRange(clipped), VolumeQuery<Frustum>(frustum), indices);
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+void SpatialIndex::query(const Sphere& sphere, std::vector<int>& indices) const
+{
+    indices.clear();
+
+    BoundingBox clipped = intersection(sphere.bounds(), extent_);
+    if (clipped.empty())
+        return;
+
+    queryCells(cellRange(clipped), VolumeQuery<Sphere>(sphere), indices);
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+void SpatialIndex::query(const Slab& slab, std::vector<int>& indices) const
+{
+    indices.clear();
+
+    BoundingBox clipped = slab.bounded() ? intersection(slab.bounds(), extent_) : extent_;
+    if (clipped.empty())
+        return;
+
+    queryCells(cellRange(clipped), VolumeQuery<Slab>(slab), indices);
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+template<typename Query>
+void SpatialIndex::queryCells(const CellRange& range, const Query& q, std::vector<int>& indices) const
+{
+    if (range.numCells() > entries_.size())
+    {
+        // Visiting the cells would be more work than checking all entities
+        for(PersistentVector<Entry>::const_iterator it = entries_.begin(); it != entries_.end(); ++it)
+        {
+            if (it->valid && q(it->box))
+                indices.push_back(it.index());
+        }
+        return;
+    }
+
+    for(int x = range.min[0]; x <= range.max[0]; ++x)
+    {
+        for(int y = range.min[1]; y <= range.max[1]; ++y)
+        {
+            for(int z = range.min[2]; z <= range.max[2]; ++z)
+            {
+                BoundingBox cell(geo::Vec3(x, y, z) * cell_size_, geo::Vec3(x + 1, y + 1, z + 1) * cell_size_);
+                if (!q(cell))
+                    continue;
+
+                const std::vector<int>& bucket = *buckets_[bucketFor(x, y, z)];
+                for(std::vector<int>::const_iterator it = bucket.begin(); it != bucket.end(); ++it)
+                {
+                    if (q(entries_[*it].box))
+                        indices.push_back(*it);
+                }
+            }
+        }
+    }
+
+    for(std::vector<int>::const_iterator it = large_->begin(); it != large_->end(); ++it)
+    {
+        if (q(entries_[*it].box))
+            indices.push_back(*it);
+    }
+
+    // Entities can be found through multiple cells
+    std::sort(indices.begin(), indices.end());
+    indices.erase(std::unique(indices.begin(), indices.end()), indices.end());
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+SpatialIndex::CellRange SpatialIndex::cellRange(const BoundingBox& box) const
+{
+    CellRange r;
+    const double* bmin[3] = { &box.min.x, &box.min.y, &box.min.z };
+    const double* bmax[3] = { &box.max.x, &box.max.y, &box.max.z };
+    for(int i = 0; i < 3; ++i)
+    {
+        // Clamp to prevent integer overflow for (nearly) unbounded boxes
+        r.min[i] = std::floor(std::max(-1e6, std::min(1e6, *bmin[i] / cell_size_)));
+        r.max[i] = std::floor(std::max(-1e6, std::min(1e6, *bmax[i] / cell_size_)));
+    }
+    return r;
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+unsigned int SpatialIndex::bucketFor(int x, int y, int z) const
+{
+    return (((unsigned int)x * 73856093u) ^ ((unsigned int)y * 19349663u) ^ ((unsigned int)z * 83492791u))
+            & (NUM_BUCKETS - 1);
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+void SpatialIndex::addToCells(int idx, const Entry& e)
+{
+    if (e.large)
+    {
+        large_ = withIndex(large_, idx);
+        return;
+    }
+
+    const CellRange& r = e.cells;
+    for(int x = r.min[0]; x <= r.max[0]; ++x)
+        for(int y = r.min[1]; y <= r.max[1]; ++y)
+            for(int z = r.min[2]; z <= r.max[2]; ++z)
+            {
+                unsigned int i_bucket = bucketFor(x, y, z);
+                const IndexListConstPtr& bucket = buckets_[i_bucket];
+
+                // Different cells can share a bucket
+                if (std::find(bucket->begin(), bucket->end(), idx) == bucket->end())
+                    buckets_.set(i_bucket, withIndex(bucket, idx));
+            }
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+void SpatialIndex::removeFromCells(int idx, const Entry& e)
+{
+    if (e.large)
+    {
+        large_ = withoutIndex(large_, idx);
+        return;
+    }
+
+    const CellRange& r = e.cells;
+    for(int x = r.min[0]; x <= r.max[0]; ++x)
+        for(int y = r.min[1]; y <= r.max[1]; ++y)
+            for(int z = r.min[2]; z <= r.max[2]; ++z)
+            {
+                unsigned int i_bucket = bucketFor(x, y, z);
+                const IndexListConstPtr& bucket = buckets_[i_bucket];
+
+                if (std::find(bucket->begin(), bucket->end(), idx) != bucket->end())
+                    buckets_.set(i_bucket, withoutIndex(bucket, idx));
+            }
+}
+
+} // end namespace sim
@@ -0,0 +1,43 @@
+#include "fast_simulator2/static_geometry.h"
+
+namespace sim
+{
+
+// ----------------------------------------------------------------------------------------------------
+
+StaticGeometry::StaticGeometry() : revision_(0)
+{
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+void StaticGeometry::set(int idx, const geo::Mesh& mesh, const geo::Pose3D& pose)
+{
+    boost::shared_ptr<Part> part(new Part);
+    part->mesh = mesh.getTransformed(pose);
+
+    const std::vector<geo::Vector3>& points = part->mesh.getPoints();
+    for(std::vector<geo::Vector3>::const_iterator it = points.begin(); it != points.end(); ++it)
+        part->bounds.add(*it);
+
+    while((int)parts_.size() <= idx)
+        parts_.push_back(PartConstPtr());
+
+    parts_.set(idx, part);
+    index_.set(idx, part->bounds);
+    ++revision_;
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+void StaticGeometry::remove(int idx)
+{
+    if (!isStatic(idx))
+        return;
+
+    parts_.set(idx, PartConstPtr());
+    index_.remove(idx);
+    ++revision_;
+}
+
+} // end namespace sim
@@ -0,0 +1,57 @@
+#include "fast_simulator2/stats.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace sim
+{
+
+namespace
+{
+
+const unsigned int NUM_BUCKETS = 32;
+
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+Histogram::Histogram() : buckets_(NUM_BUCKETS, 0), count_(0), sum_(0), max_(0)
+{
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+void Histogram::add(double seconds)
+{
+    double us = seconds * 1e6;
+
+    unsigned int i = 0;
+    if (us >= 1)
+        i = std::min<unsigned int>(NUM_BUCKETS - 1, std::floor(std::log(us) / std::log(2.0)));
+
+    ++buckets_[i];
+    ++count_;
+    sum_ += seconds;
+    if (seconds > max_)
+        max_ = seconds;
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+double Histogram::percentile(double p) const
+{
+    if (count_ == 0)
+        return 0;
+
+    unsigned long n = 0;
+    for(unsigned int i = 0; i < buckets_.size(); ++i)
+    {
+        n += buckets_[i];
+        if (n >= p * count_)
+            return std::min(max_, std::ldexp(1e-6, i + 1));
+    }
+
+    return max_;
+}
+
+} // end namespace sim
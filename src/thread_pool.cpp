@@ -0,0 +1,234 @@
+#include "fast_simulator2/thread_pool.h"
+
+#include <boost/bind.hpp>
+
+namespace sim
+{
+
+namespace
+{
+
+struct WorkerId
+{
+    WorkerId(const ThreadPool* pool_, int index_) : pool(pool_), index(index_) {}
+    const ThreadPool* pool;
+    int index;
+};
+
+boost::thread_specific_ptr<WorkerId> current_worker;
+
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+ThreadPool::ThreadPool(unsigned int num_threads) : num_queued_(0), num_waiters_(0), generation_(0), i_next_worker_(0),
+    stop_(false)
+{
+    if (num_threads == 0)
+        num_threads = std::max(1u, boost::thread::hardware_concurrency());
+
+    for(unsigned int i = 0; i < num_threads; ++i)
+        workers_.push_back(new Worker);
+
+    for(unsigned int i = 0; i < num_threads; ++i)
+        threads_.create_thread(boost::bind(&ThreadPool::run, this, i));
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+ThreadPool::~ThreadPool()
+{
+    {
+        boost::lock_guard<boost::mutex> lg(mutex_wakeup_);
+        stop_ = true;
+    }
+
+    cond_wakeup_.notify_all();
+
+    // Workers finish all queued tasks before they exit
+    threads_.join_all();
+
+    for(std::vector<Worker*>::iterator it = workers_.begin(); it != workers_.end(); ++it)
+        delete *it;
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+void ThreadPool::submit(const Task& task)
+{
+    int i_worker = currentWorker();
+
+    if (i_worker < 0)
+    {
+        boost::lock_guard<boost::mutex> lg(mutex_wakeup_);
+        i_worker = i_next_worker_;
+        i_next_worker_ = (i_next_worker_ + 1) % workers_.size();
+    }
+
+    // Count the task before it can be popped (and uncounted) by another thread. A worker that sees the
+    // count before the task is pushed only retries briefly.
+    bool has_waiters;
+    {
+        boost::lock_guard<boost::mutex> lg(mutex_wakeup_);
+        ++num_queued_;
+        has_waiters = num_waiters_ > 0;
+    }
+
+    {
+        Worker& w = *workers_[i_worker];
+        boost::lock_guard<boost::mutex> lg(w.mutex);
+        w.tasks.push_back(task);
+    }
+
+    cond_wakeup_.notify_one();
+
+    // Waiting threads help executing tasks
+    if (has_waiters)
+        cond_waiters_.notify_all();
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+void ThreadPool::notifyWaiters()
+{
+    boost::lock_guard<boost::mutex> lg(mutex_wakeup_);
+    ++generation_;
+    if (num_waiters_ > 0)
+        cond_waiters_.notify_all();
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+bool ThreadPool::runPendingTask()
+{
+    Task task;
+    if (!popTask(currentWorker(), task))
+        return false;
+
+    task();
+    return true;
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+void ThreadPool::run(unsigned int i_worker)
+{
+    current_worker.reset(new WorkerId(this, i_worker));
+
+    while(true)
+    {
+        Task task;
+        if (popTask(i_worker, task))
+        {
+            task();
+            continue;
+        }
+
+        boost::unique_lock<boost::mutex> lock(mutex_wakeup_);
+        while(num_queued_ == 0 && !stop_)
+            cond_wakeup_.wait(lock);
+
+        if (stop_ && num_queued_ == 0)
+            break;
+    }
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+bool ThreadPool::popTask(int i_worker, Task& task)
+{
+    bool found = false;
+
+    // First try our own queue (newest task first)
+    if (i_worker >= 0)
+    {
+        Worker& w = *workers_[i_worker];
+        boost::lock_guard<boost::mutex> lg(w.mutex);
+        if (!w.tasks.empty())
+        {
+            task = w.tasks.back();
+            w.tasks.pop_back();
+            found = true;
+        }
+    }
+
+    // Otherwise steal the oldest task of one of the other workers
+    for(unsigned int i = 1; !found && i <= workers_.size(); ++i)
+    {
+        unsigned int i_victim = (std::max(i_worker, 0) + i) % workers_.size();
+        Worker& w = *workers_[i_victim];
+        boost::lock_guard<boost::mutex> lg(w.mutex);
+        if (!w.tasks.empty())
+        {
+            task = w.tasks.front();
+            w.tasks.pop_front();
+            found = true;
+        }
+    }
+
+    if (found)
+    {
+        boost::lock_guard<boost::mutex> lg(mutex_wakeup_);
+        --num_queued_;
+    }
+
+    return found;
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+int ThreadPool::currentWorker() const
+{
+    const WorkerId* id = current_worker.get();
+    if (id && id->pool == this)
+        return id->index;
+    return -1;
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+void TaskGroup::run(const Task& task)
+{
+    {
+        boost::lock_guard<boost::mutex> lg(mutex_);
+        ++num_pending_;
+    }
+
+    pool_.submit(boost::bind(&TaskGroup::execute, this, task));
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+void TaskGroup::wait()
+{
+    // Helps executing tasks instead of blocking a (possibly worker) thread
+    pool_.waitUntil(boost::bind(&TaskGroup::finished, this));
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+bool TaskGroup::finished() const
+{
+    boost::lock_guard<boost::mutex> lg(mutex_);
+    return num_pending_ == 0;
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+void TaskGroup::execute(const Task& task)
+{
+    task();
+
+    // The group may be destroyed as soon as its last task is done
+    ThreadPool& pool = pool_;
+
+    {
+        boost::lock_guard<boost::mutex> lg(mutex_);
+        if (--num_pending_ > 0)
+            return;
+    }
+
+    pool.notifyWaiters();
+}
+
+} // end namespace sim
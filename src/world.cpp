@@ -0,0 +1,600 @@
+#include "fast_simulator2/world.h"
+#include "fast_simulator2/thread_pool.h"
+
+#include <ed/update_request.h>
+#include <ed/entity.h>
+#include <ed/relation.h>
+
+#include <geolib/Shape.h>
+
+#include <boost/bind.hpp>
+
+#include <algorithm>
+#include <limits>
+#include <set>
+
+namespace sim
+{
+
+namespace
+{
+
+// ID of the root of the world frame, interned once
+const LUId& worldId()
+{
+    static const LUId id("world");
+    return id;
+}
+
+// Minimum number of entities per task when calculating the poses in parallel. Calculating a pose takes
+// about 0.1 us, so smaller tasks would mostly measure the scheduling overhead.
+const unsigned int MIN_ENTITIES_PER_TASK = 2000;
+
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+World::World() : revision_(0), num_entities_(0), next_static_check_(std::numeric_limits<unsigned long>::max()),
+    pose_cache_(new PoseCache)
+{
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+void World::update(const ed::UpdateRequest& req)
+{
+    // Poses calculated for the world this one was copied from are not valid anymore
+    pose_cache_.reset(new PoseCache);
+
+    // Entities that are changed by this request. Each entity is cloned at most once per update.
+    std::map<int, ed::EntityPtr> new_entities;
+
+    // Entities of which the shape or pose changes
+    std::set<int> moved;
+
+    // Update types
+    for(std::map<ed::UUID, std::string>::const_iterator it = req.types.begin(); it != req.types.end(); ++it)
+    {
+        int idx = getOrAddEntity(it->first.str(), new_entities);
+        mutableEntity(idx, new_entities)->setType(it->second);
+    }
+
+    // Update shapes
+    for(std::map<ed::UUID, geo::ShapeConstPtr>::const_iterator it = req.shapes.begin(); it != req.shapes.end(); ++it)
+    {
+        int idx = getOrAddEntity(it->first.str(), new_entities);
+        mutableEntity(idx, new_entities)->setShape(it->second);
+        moved.insert(idx);
+
+        // Only recompute the local bounds if the shape changes, not on every pose update
+        BoundingBox box;
+        if (it->second)
+        {
+            const std::vector<geo::Vector3>& points = it->second->getMesh().getPoints();
+            for(std::vector<geo::Vector3>::const_iterator it2 = points.begin(); it2 != points.end(); ++it2)
+                box.add(*it2);
+        }
+        local_bounds_.set(idx, box);
+    }
+
+    // Update poses
+    for(std::map<ed::UUID, geo::Pose3D>::const_iterator it = req.poses.begin(); it != req.poses.end(); ++it)
+    {
+        int idx = getOrAddEntity(it->first.str(), new_entities);
+        mutableEntity(idx, new_entities)->setPose(it->second);
+        moved.insert(idx);
+    }
+
+    // Update relations
+    for(std::map<ed::UUID, std::map<ed::UUID, ed::RelationConstPtr> >::const_iterator it = req.relations.begin();
+        it != req.relations.end(); ++it)
+    {
+        int parent = getOrAddEntity(it->first.str(), new_entities);
+
+        const std::map<ed::UUID, ed::RelationConstPtr>& rels = it->second;
+        for(std::map<ed::UUID, ed::RelationConstPtr>::const_iterator it2 = rels.begin(); it2 != rels.end(); ++it2)
+        {
+            int child = getOrAddEntity(it2->first.str(), new_entities);
+            setRelation(parent, child, it2->second);
+        }
+    }
+
+    // Store the changed entities and update their position in the spatial index
+    for(std::map<int, ed::EntityPtr>::const_iterator it = new_entities.begin(); it != new_entities.end(); ++it)
+    {
+        entities_.set(it->first, it->second);
+
+        if (it->second->shape())
+            spatial_index_.set(it->first, local_bounds_[it->first].transformed(it->second->pose()));
+        else
+            spatial_index_.remove(it->first);
+    }
+
+    // Entities that change are not static (anymore). They become static again if they stay unchanged
+    // for STATIC_AGE updates.
+    for(std::set<int>::const_iterator it = moved.begin(); it != moved.end(); ++it)
+    {
+        unsigned long since = revision_ + 1 + STATIC_AGE;
+        static_since_.set(*it, since);
+        next_static_check_ = std::min(next_static_check_, since);
+        static_geometry_.remove(*it);
+    }
+
+    // Remove entities
+    for(std::set<ed::UUID>::const_iterator it = req.removed_entities.begin(); it != req.removed_entities.end(); ++it)
+    {
+        int idx;
+        if (findEntityIdx(it->str(), idx))
+            removeEntity(idx);
+    }
+
+    ++revision_;
+
+    if (revision_ >= next_static_check_)
+        updateStaticGeometry();
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+void World::markStatic(const std::vector<UUId>& ids)
+{
+    // Only the given entities change state, so this does not need the full scan of
+    // updateStaticGeometry()
+    for(std::vector<UUId>::const_iterator it = ids.begin(); it != ids.end(); ++it)
+    {
+        int idx;
+        if (!findEntityIdx(*it, idx) || static_geometry_.isStatic(idx))
+            continue;
+
+        static_since_.set(idx, revision_);
+
+        const ed::EntityConstPtr& e = entities_[idx];
+        if (e && e->shape())
+            static_geometry_.set(idx, e->shape()->getMesh(), e->pose());
+    }
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+void World::updateStaticGeometry()
+{
+    // O(N), but only done when an entity may have become static: while entities keep moving, at most
+    // once every STATIC_AGE updates
+    next_static_check_ = std::numeric_limits<unsigned long>::max();
+
+    for(unsigned int idx = 0; idx < entities_.size(); ++idx)
+    {
+        const ed::EntityConstPtr& e = entities_[idx];
+        if (!e || !e->shape() || static_geometry_.isStatic(idx))
+            continue;
+
+        unsigned long since = static_since_[idx];
+        if (since <= revision_)
+            static_geometry_.set(idx, e->shape()->getMesh(), e->pose());
+        else
+            next_static_check_ = std::min(next_static_check_, since);
+    }
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+ed::EntityConstPtr World::getEntity(const UUId& id) const
+{
+    int idx;
+    if (!findEntityIdx(id, idx))
+        return ed::EntityConstPtr();
+    return entities_[idx];
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+ed::EntityConstPtr World::getEntity(const LUId& id) const
+{
+    int idx;
+    if (!findEntityIdx(id, idx))
+        return ed::EntityConstPtr();
+    return entities_[idx];
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+bool World::findEntityIdx(const LUId& id, int& idx) const
+{
+    if (id.index < 0 || id.index >= (int)entity_idx_by_key_.size())
+        return false;
+
+    idx = entity_idx_by_key_[id.index];
+    return idx >= 0;
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+bool World::findEntityIdx(const UUId& id, int& idx) const
+{
+    // An ID that was never interned cannot be the ID of an entity
+    int key;
+    if (!findInternedId(id, key) || key >= (int)entity_idx_by_key_.size())
+        return false;
+
+    idx = entity_idx_by_key_[key];
+    return idx >= 0;
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+bool World::calculateTransform(const UUId& source, const UUId& target, double time, geo::Pose3D& tf) const
+{
+    int source_idx, target_idx;
+    if (!findEntityIdx(source, source_idx) || !findEntityIdx(target, target_idx))
+        return false;
+
+    geo::Pose3D source_pose, target_pose;
+    int source_root, target_root;
+
+    PoseTableConstPtr table = findPoseTable(time);
+    if (table)
+    {
+        source_root = table->roots[source_idx];
+        target_root = table->roots[target_idx];
+        if (source_root < 0)
+            return false;
+
+        source_pose = table->poses[source_idx];
+        target_pose = table->poses[target_idx];
+    }
+    else if (!poseInRoot(source_idx, time, source_pose, source_root) || !poseInRoot(target_idx, time, target_pose, target_root))
+        return false;
+
+    // Both entities must be in the same tree
+    if (source_root != target_root)
+        return false;
+
+    tf = source_pose.inverse() * target_pose;
+    return true;
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+bool World::worldPose(int idx, double time, geo::Pose3D& pose) const
+{
+    if (idx < 0 || idx >= (int)entities_.size() || !entities_[idx])
+        return false;
+
+    PoseTableConstPtr table = findPoseTable(time);
+    if (table)
+    {
+        if (table->world_idx < 0 || table->roots[idx] != table->world_idx)
+            return false;
+
+        pose = table->poses[idx];
+        return true;
+    }
+
+    int world_idx, root;
+    return findEntityIdx(worldId(), world_idx) && poseInRoot(idx, time, pose, root) && root == world_idx;
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+bool World::worldPose(const UUId& id, double time, geo::Pose3D& pose) const
+{
+    int idx;
+    return findEntityIdx(id, idx) && worldPose(idx, time, pose);
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+bool World::worldPose(const LUId& id, double time, geo::Pose3D& pose) const
+{
+    int idx;
+    return findEntityIdx(id, idx) && worldPose(idx, time, pose);
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+void World::preparePoses(double time, ThreadPool* pool) const
+{
+    if (findPoseTable(time))
+        return;
+
+    // Calculated without holding the lock, so readers of other times are not blocked
+    boost::shared_ptr<PoseTable> table(new PoseTable);
+    table->time = time;
+    calculatePoses(*table, pool);
+
+    PoseCache& cache = *pose_cache_;
+    const unsigned int num_slots = sizeof(cache.tables) / sizeof(cache.tables[0]);
+
+    boost::lock_guard<boost::mutex> lg(cache.mutex);
+    for(unsigned int i = 0; i < num_slots; ++i)
+    {
+        if (cache.tables[i] && cache.tables[i]->time == time)
+            return;
+    }
+
+    cache.tables[cache.next] = table;
+    cache.next = (cache.next + 1) % num_slots;
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+World::PoseTableConstPtr World::findPoseTable(double time) const
+{
+    PoseCache& cache = *pose_cache_;
+    const unsigned int num_slots = sizeof(cache.tables) / sizeof(cache.tables[0]);
+
+    boost::lock_guard<boost::mutex> lg(cache.mutex);
+    for(unsigned int i = 0; i < num_slots; ++i)
+    {
+        if (cache.tables[i] && cache.tables[i]->time == time)
+            return cache.tables[i];
+    }
+
+    return PoseTableConstPtr();
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+void World::calculatePoses(PoseTable& table, ThreadPool* pool) const
+{
+    table.poses.resize(entities_.size());
+    table.roots.assign(entities_.size(), -1);
+
+    if (!findEntityIdx(worldId(), table.world_idx))
+        table.world_idx = -1;
+
+    // Walk each tree from its root down, so the pose of each entity is its parent pose times one
+    // relation: O(N) for all entities, instead of O(depth) per entity per query. The roots and their
+    // children are done here; the subtrees below the children are independent.
+    std::vector<int> starts;
+    for(unsigned int root = 0; root < entities_.size(); ++root)
+    {
+        if (!entities_[root] || parent_relations_[root] >= 0)
+            continue;
+
+        table.poses[root] = geo::Pose3D::identity();
+        table.roots[root] = root;
+
+        const IndexListConstPtr& children = child_relations_[root];
+        if (!children)
+            continue;
+
+        for(std::vector<int>::const_iterator it = children->begin(); it != children->end(); ++it)
+        {
+            const RelationEntry& entry = relations_[*it];
+
+            // If the relation cannot be calculated, the subtree of the child has no pose
+            if (!entry.relation || !entry.relation->calculateTransform(ed::Time(table.time), table.poses[entry.child]))
+                continue;
+
+            table.roots[entry.child] = root;
+            starts.push_back(entry.child);
+        }
+    }
+
+    unsigned int num_tasks = 1;
+    if (pool)
+        num_tasks = std::max(1u, std::min<unsigned int>(pool->numThreads(), entities_.size() / MIN_ENTITIES_PER_TASK));
+
+    num_tasks = std::min<unsigned int>(num_tasks, starts.size());
+
+    if (num_tasks <= 1)
+    {
+        calculateSubtreePoses(&table, &starts, 0, starts.size());
+        return;
+    }
+
+    // The subtrees write disjoint entries of the table
+    TaskGroup tasks(*pool);
+    int starts_per_task = (starts.size() + num_tasks - 1) / num_tasks;
+    for(int i = 0; i < (int)starts.size(); i += starts_per_task)
+        tasks.run(boost::bind(&World::calculateSubtreePoses, this, &table, &starts, i,
+                              std::min<int>(i + starts_per_task, starts.size())));
+    tasks.wait();
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+void World::calculateSubtreePoses(PoseTable* table, const std::vector<int>* starts, int i_begin, int i_end) const
+{
+    std::vector<int> stack(starts->begin() + i_begin, starts->begin() + i_end);
+    while(!stack.empty())
+    {
+        int parent = stack.back();
+        stack.pop_back();
+
+        const IndexListConstPtr& children = child_relations_[parent];
+        if (!children)
+            continue;
+
+        for(std::vector<int>::const_iterator it = children->begin(); it != children->end(); ++it)
+        {
+            const RelationEntry& entry = relations_[*it];
+
+            geo::Pose3D rel_pose;
+            if (!entry.relation || !entry.relation->calculateTransform(ed::Time(table->time), rel_pose))
+                continue;
+
+            table->poses[entry.child] = table->poses[parent] * rel_pose;
+            table->roots[entry.child] = table->roots[parent];
+            stack.push_back(entry.child);
+        }
+    }
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+bool World::poseInRoot(int idx, double time, geo::Pose3D& pose, int& root) const
+{
+    pose = geo::Pose3D::identity();
+
+    int r_idx;
+    while((r_idx = parent_relations_[idx]) >= 0)
+    {
+        const RelationEntry& entry = relations_[r_idx];
+
+        geo::Pose3D rel_pose;
+        if (!entry.relation || !entry.relation->calculateTransform(ed::Time(time), rel_pose))
+            return false;
+
+        pose = rel_pose * pose;
+        idx = entry.parent;
+    }
+
+    root = idx;
+    return true;
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+int World::getOrAddEntity(const UUId& id, std::map<int, ed::EntityPtr>& new_entities)
+{
+    int idx;
+    if (findEntityIdx(id, idx))
+        return idx;
+
+    idx = entities_.size();
+    entities_.push_back(ed::EntityConstPtr());
+    parent_relations_.push_back(-1);
+    child_relations_.push_back(IndexListConstPtr());
+    local_bounds_.push_back(BoundingBox());
+    static_since_.push_back(revision_ + 1 + STATIC_AGE);
+    insertId(id, idx);
+
+    new_entities[idx] = ed::EntityPtr(new ed::Entity(id));
+    ++num_entities_;
+
+    return idx;
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+ed::EntityPtr World::mutableEntity(int idx, std::map<int, ed::EntityPtr>& new_entities)
+{
+    std::map<int, ed::EntityPtr>::iterator it = new_entities.find(idx);
+    if (it != new_entities.end())
+        return it->second;
+
+    // Copy-on-write: the current entity may be shared with other snapshots
+    ed::EntityPtr e(new ed::Entity(*entities_[idx]));
+    new_entities[idx] = e;
+    return e;
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+void World::setRelation(int parent, int child, const ed::RelationConstPtr& r)
+{
+    int r_idx = parent_relations_[child];
+
+    if (r_idx >= 0 && relations_[r_idx].parent == parent)
+    {
+        // Relation already exists: only replace the relation itself
+        RelationEntry entry = relations_[r_idx];
+        entry.relation = r;
+        relations_.set(r_idx, entry);
+        return;
+    }
+
+    // The child gets a new parent: detach it from the old one
+    if (r_idx >= 0)
+    {
+        removeChildRelation(relations_[r_idx].parent, r_idx);
+        relations_.set(r_idx, RelationEntry());
+    }
+
+    RelationEntry entry;
+    entry.parent = parent;
+    entry.child = child;
+    entry.relation = r;
+
+    r_idx = relations_.size();
+    relations_.push_back(entry);
+    parent_relations_.set(child, r_idx);
+
+    boost::shared_ptr<std::vector<int> > children;
+    if (child_relations_[parent])
+        children.reset(new std::vector<int>(*child_relations_[parent]));
+    else
+        children.reset(new std::vector<int>);
+
+    children->push_back(r_idx);
+    child_relations_.set(parent, children);
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+void World::removeChildRelation(int parent, int r_idx)
+{
+    const IndexListConstPtr& old_children = child_relations_[parent];
+    if (!old_children)
+        return;
+
+    boost::shared_ptr<std::vector<int> > children(new std::vector<int>);
+    for(std::vector<int>::const_iterator it = old_children->begin(); it != old_children->end(); ++it)
+    {
+        if (*it != r_idx)
+            children->push_back(*it);
+    }
+
+    child_relations_.set(parent, children);
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+void World::removeEntity(int idx)
+{
+    const ed::EntityConstPtr& e = entities_[idx];
+    if (!e)
+        return;
+
+    eraseId(e->id().str());
+
+    // Detach from parent
+    int r_idx = parent_relations_[idx];
+    if (r_idx >= 0)
+    {
+        removeChildRelation(relations_[r_idx].parent, r_idx);
+        relations_.set(r_idx, RelationEntry());
+        parent_relations_.set(idx, -1);
+    }
+
+    // Detach children
+    IndexListConstPtr children = child_relations_[idx];
+    if (children)
+    {
+        for(std::vector<int>::const_iterator it = children->begin(); it != children->end(); ++it)
+        {
+            parent_relations_.set(relations_[*it].child, -1);
+            relations_.set(*it, RelationEntry());
+        }
+        child_relations_.set(idx, IndexListConstPtr());
+    }
+
+    entities_.set(idx, ed::EntityConstPtr());
+    spatial_index_.remove(idx);
+    static_geometry_.remove(idx);
+    --num_entities_;
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+void World::insertId(const UUId& id, int idx)
+{
+    int key = internId(id);
+    while((int)entity_idx_by_key_.size() <= key)
+        entity_idx_by_key_.push_back(-1);
+
+    entity_idx_by_key_.set(key, idx);
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+void World::eraseId(const UUId& id)
+{
+    int key;
+    if (findInternedId(id, key) && key < (int)entity_idx_by_key_.size())
+        entity_idx_by_key_.set(key, -1);
+}
+
+} // end namespace sim
@@ -0,0 +1,172 @@
+#include "fast_simulator2/depth_buffer.h"
+
+#include <gtest/gtest.h>
+
+#include <cstdlib>
+
+// ----------------------------------------------------------------------------------------------------
+//
+// The depth buffer uses SSE/AVX where available (depending on the compiler flags), with a scalar tail
+// for the last pixels of a row. The results are compared against a plain scalar implementation of the
+// depth test. Odd widths and offsets make sure that both the vector lanes and the tails are covered.
+//
+// ----------------------------------------------------------------------------------------------------
+
+namespace
+{
+
+// Depths are drawn from a small set, so there are many ties (which must not replace the old depth)
+float randomDepth()
+{
+    return rand() % 3 == 0 ? 0 : 0.5f * (1 + rand() % 6);
+}
+
+// Reference depth test of a single pixel
+void depthTest(float depth, int label, float& pixel, int& pixel_label)
+{
+    if (depth != 0 && (pixel == 0 || depth < pixel))
+    {
+        pixel = depth;
+        pixel_label = label;
+    }
+}
+
+struct Image
+{
+    Image(int width_, int height_) : width(width_), height(height_), stride(width_ + 3),
+        depths(stride * height_), labels(stride * height_)
+    {
+        for(unsigned int i = 0; i < depths.size(); ++i)
+        {
+            depths[i] = randomDepth();
+            labels[i] = rand();
+        }
+    }
+
+    sim::DepthBuffer buffer() { return sim::DepthBuffer(&depths[0], &labels[0], width, height, stride); }
+
+    int width, height, stride;
+    std::vector<float> depths;
+    std::vector<int> labels;
+};
+
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+TEST(DepthBuffer, WriteSpanMatchesScalar)
+{
+    srand(0);
+
+    for(int t = 0; t < 500; ++t)
+    {
+        Image image(1 + rand() % 45, 3);
+        Image expected = image;
+
+        int y = rand() % image.height;
+        int x = rand() % image.width;
+        int n = 1 + rand() % (image.width - x);
+        int label = rand();
+
+        std::vector<float> span(n);
+        for(int i = 0; i < n; ++i)
+        {
+            span[i] = randomDepth();
+            depthTest(span[i], label, expected.depths[y * image.stride + x + i], expected.labels[y * image.stride + x + i]);
+        }
+
+        image.buffer().writeSpan(x, y, &span[0], n, label);
+
+        ASSERT_EQ(expected.depths, image.depths);
+        ASSERT_EQ(expected.labels, image.labels);
+    }
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+TEST(DepthBuffer, WriteSpanWithoutLabels)
+{
+    float depths[11] = { 0, 1, 2, 0, 1, 2, 0, 1, 2, 0, 1 };
+    float span[11] = { 1, 1, 1, 0, 0, 0, 3, 3, 3, 0.5f, 0.5f };
+
+    sim::DepthBuffer buffer(depths, 11, 1, 11);
+    buffer.writeSpan(0, 0, span, 11);
+
+    float expected[11] = { 1, 1, 1, 0, 1, 2, 3, 1, 2, 0.5f, 0.5f };
+    for(int i = 0; i < 11; ++i)
+        EXPECT_EQ(expected[i], depths[i]) << "pixel " << i;
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+TEST(DepthBuffer, MergeMatchesScalar)
+{
+    srand(1);
+
+    for(int t = 0; t < 200; ++t)
+    {
+        Image image(1 + rand() % 45, 1 + rand() % 5);
+        Image other(image.width, image.height);
+        Image expected = image;
+
+        int row_begin = rand() % image.height;
+        int row_end = row_begin + 1 + rand() % (image.height - row_begin);
+
+        for(int y = row_begin; y < row_end; ++y)
+        {
+            for(int x = 0; x < image.width; ++x)
+            {
+                int i = y * image.stride + x;
+                depthTest(other.depths[i], other.labels[i], expected.depths[i], expected.labels[i]);
+            }
+        }
+
+        image.buffer().merge(other.buffer(), row_begin, row_end);
+
+        // Rows outside the range, and the padding at the end of the rows, are not touched
+        ASSERT_EQ(expected.depths, image.depths);
+        ASSERT_EQ(expected.labels, image.labels);
+    }
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+TEST(DepthBuffer, RenderResultCollectsSpans)
+{
+    srand(2);
+
+    Image image(37, 4);
+    Image expected = image;
+
+    {
+        sim::DepthBufferRenderResult result(image.buffer());
+
+        // Pixels in scanline order with gaps and row changes, like the rasterizer reports them
+        for(int label = 1; label <= 3; ++label)
+        {
+            result.setLabel(label);
+            for(int y = 0; y < image.height; ++y)
+            {
+                for(int x = rand() % 5; x < image.width; x += 1 + (rand() % 8 == 0))
+                {
+                    float depth = randomDepth();
+                    depthTest(depth, label, expected.depths[y * image.stride + x], expected.labels[y * image.stride + x]);
+                    result.renderPixel(x, y, depth, 0);
+                }
+            }
+        }
+
+        // The last span is written when the result is destroyed
+    }
+
+    EXPECT_EQ(expected.depths, image.depths);
+    EXPECT_EQ(expected.labels, image.labels);
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+int main(int argc, char **argv)
+{
+    testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
@@ -0,0 +1,132 @@
+#include "fast_simulator2/depth_codec.h"
+
+#include <gtest/gtest.h>
+
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+
+// ----------------------------------------------------------------------------------------------------
+
+namespace
+{
+
+// Floor, a box and a slanted wall, with some missing pixels, like a rendered depth image. The rows
+// have padding at the end ('stride' > 'width').
+std::vector<float> createImage(int width, int height, int stride)
+{
+    std::vector<float> image(stride * height, 0);
+    for(int y = 0; y < height; ++y)
+    {
+        for(int x = 0; x < width; ++x)
+        {
+            float d = 0;
+            if (y > height * 5 / 8)
+                d = 1.0f + 1000.0f / (y - height * 5 / 8 + 10);
+            else if (x > width / 3 && x < width * 2 / 3 && y > height / 5)
+                d = 1.5f + 0.001f * x;
+            else if (y > height / 10)
+                d = 4.0f - 0.002f * x + 0.001f * y;
+
+            if (rand() % 500 == 0)
+                d = 0;
+
+            image[y * stride + x] = d;
+        }
+    }
+    return image;
+}
+
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+TEST(DepthCodec, RoundTripIsLossless)
+{
+    srand(0);
+
+    int width = 641, height = 480, stride = 650;
+    std::vector<float> image = createImage(width, height, stride);
+
+    // Special values must survive as well
+    image[10] = std::numeric_limits<float>::quiet_NaN();
+    image[11] = std::numeric_limits<float>::infinity();
+    image[12] = 1e-30f;
+
+    std::vector<unsigned char> encoded;
+    sim::encodeDepth(&image[0], width, height, stride, encoded);
+
+    // Rendered images compress well
+    EXPECT_LT(encoded.size(), image.size() * sizeof(float) / 2);
+
+    std::vector<float> decoded;
+    int decoded_width, decoded_height;
+    ASSERT_TRUE(sim::decodeDepth(&encoded[0], encoded.size(), decoded_width, decoded_height, decoded));
+    ASSERT_EQ(width, decoded_width);
+    ASSERT_EQ(height, decoded_height);
+    ASSERT_EQ((unsigned int)(width * height), decoded.size());
+
+    // Bit-exact (NaN != NaN, so compare the bytes)
+    for(int y = 0; y < height; ++y)
+        ASSERT_EQ(0, std::memcmp(&decoded[y * width], &image[y * stride], width * sizeof(float))) << "row " << y;
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+TEST(DepthCodec, EmptyAndTinyImages)
+{
+    int sizes[][2] = { { 0, 0 }, { 1, 1 }, { 3, 1 }, { 1, 3 } };
+    for(unsigned int i = 0; i < sizeof(sizes) / sizeof(sizes[0]); ++i)
+    {
+        int width = sizes[i][0], height = sizes[i][1];
+        std::vector<float> image(width * height + 1, 2.5f);
+
+        std::vector<unsigned char> encoded;
+        sim::encodeDepth(&image[0], width, height, width, encoded);
+
+        std::vector<float> decoded;
+        int decoded_width, decoded_height;
+        ASSERT_TRUE(sim::decodeDepth(&encoded[0], encoded.size(), decoded_width, decoded_height, decoded));
+        EXPECT_EQ(width, decoded_width);
+        EXPECT_EQ(height, decoded_height);
+        for(int j = 0; j < width * height; ++j)
+            EXPECT_EQ(2.5f, decoded[j]);
+    }
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+TEST(DepthCodec, RejectsInvalidData)
+{
+    srand(1);
+
+    int width = 64, height = 48;
+    std::vector<float> image = createImage(width, height, width);
+
+    std::vector<unsigned char> encoded;
+    sim::encodeDepth(&image[0], width, height, width, encoded);
+
+    std::vector<float> decoded;
+    int decoded_width, decoded_height;
+
+    // Truncated
+    EXPECT_FALSE(sim::decodeDepth(&encoded[0], encoded.size() / 2, decoded_width, decoded_height, decoded));
+
+    // Random data must not crash (it may happen to be valid)
+    for(int i = 0; i < 2000; ++i)
+    {
+        std::vector<unsigned char> garbage(1 + rand() % 100);
+        for(unsigned int j = 0; j < garbage.size(); ++j)
+            garbage[j] = rand();
+        sim::decodeDepth(&garbage[0], garbage.size(), decoded_width, decoded_height, decoded);
+    }
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+int main(int argc, char **argv)
+{
+    testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
@@ -0,0 +1,151 @@
+#include "fast_simulator2/laser_scan.h"
+#include "fast_simulator2/thread_pool.h"
+
+#include <geolib/sensors/LaserRangeFinder.h>
+
+#include <gtest/gtest.h>
+
+#include <cmath>
+
+// ----------------------------------------------------------------------------------------------------
+
+namespace
+{
+
+// Appends an axis-aligned box (12 triangles) to the mesh
+void addBox(geo::Mesh& mesh, const geo::Vec3& min, const geo::Vec3& max)
+{
+    int i0 = mesh.getPoints().size();
+    for(int i = 0; i < 8; ++i)
+        mesh.addPoint(i & 1 ? max.x : min.x, i & 2 ? max.y : min.y, i & 4 ? max.z : min.z);
+
+    int faces[12][3] = { { 0, 1, 3 }, { 0, 3, 2 }, { 4, 5, 7 }, { 4, 7, 6 }, { 0, 1, 5 }, { 0, 5, 4 },
+                         { 2, 3, 7 }, { 2, 7, 6 }, { 0, 2, 6 }, { 0, 6, 4 }, { 1, 3, 7 }, { 1, 7, 5 } };
+    for(int i = 0; i < 12; ++i)
+        mesh.addTriangle(i0 + faces[i][0], i0 + faces[i][1], i0 + faces[i][2]);
+}
+
+std::vector<sim::LineSegment> slice(const geo::Mesh& mesh)
+{
+    sim::PlaneSlicer slicer;
+    std::vector<sim::LineSegment> segments;
+    slicer.slice(mesh, geo::Pose3D::identity(), segments);
+    return segments;
+}
+
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+TEST(BeamCaster, RangesInsideBox)
+{
+    // The laser is in the center of a 4 x 4 m room
+    geo::Mesh room;
+    addBox(room, geo::Vec3(-2, -2, -1), geo::Vec3(2, 2, 1));
+    std::vector<sim::LineSegment> segments = slice(room);
+
+    int num_beams = 1081;
+    double angle_min = -M_PI, angle_increment = 2 * M_PI / (num_beams - 1);
+
+    sim::BeamCaster caster;
+    caster.configure(angle_min, angle_increment, num_beams, 0.1, 30);
+    ASSERT_EQ((unsigned int)num_beams, caster.numBeams());
+
+    std::vector<float> ranges(num_beams);
+    caster.cast(segments, &ranges[0]);
+
+    for(int i = 0; i < num_beams; ++i)
+    {
+        double a = angle_min + i * angle_increment;
+        double expected = 2 / std::max(std::abs(std::cos(a)), std::abs(std::sin(a)));
+        ASSERT_NEAR(expected, ranges[i], 1e-4 * expected) << "beam " << i;
+    }
+
+    // Hits beyond the maximum range are not reported: only the beams towards the middle of the walls
+    // are within 2.1 m
+    caster.configure(angle_min, angle_increment, num_beams, 0.1, 2.1);
+    caster.cast(segments, &ranges[0]);
+    for(int i = 0; i < num_beams; ++i)
+    {
+        double a = angle_min + i * angle_increment;
+        double expected = 2 / std::max(std::abs(std::cos(a)), std::abs(std::sin(a)));
+        if (expected < 2.099)
+            ASSERT_NEAR(expected, ranges[i], 1e-4 * expected) << "beam " << i;
+        else if (expected > 2.101)
+            ASSERT_EQ(0, ranges[i]) << "beam " << i;
+    }
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+TEST(BeamCaster, ParallelMatchesSerial)
+{
+    geo::Mesh mesh;
+    addBox(mesh, geo::Vec3(-8, -8, -1), geo::Vec3(8, 8, 1));
+    for(int i = 0; i < 200; ++i)
+    {
+        double x = -7 + 0.07 * i, y = 3 * std::sin(0.3 * i);
+        addBox(mesh, geo::Vec3(x, y, -0.5), geo::Vec3(x + 0.05, y + 0.2, 0.5));
+    }
+    std::vector<sim::LineSegment> segments = slice(mesh);
+
+    int num_beams = 4000;
+    sim::BeamCaster caster;
+    caster.configure(-2.35, 4.7 / (num_beams - 1), num_beams, 0.01, 30);
+
+    std::vector<float> ranges_serial(num_beams), ranges_parallel(num_beams);
+    caster.cast(segments, &ranges_serial[0]);
+
+    sim::ThreadPool pool(4);
+    caster.cast(segments, &ranges_parallel[0], &pool);
+
+    EXPECT_EQ(ranges_serial, ranges_parallel);
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+TEST(BeamCaster, MatchesLaserRangeFinder)
+{
+    // Room with some obstacles, including one that crosses the angle of -pi / pi
+    geo::Mesh mesh;
+    addBox(mesh, geo::Vec3(-5, -4, -1), geo::Vec3(5, 4, 1));
+    addBox(mesh, geo::Vec3(1, 0.5, -0.5), geo::Vec3(1.3, 0.9, 0.5));
+    addBox(mesh, geo::Vec3(-2, -0.3, -0.5), geo::Vec3(-1.5, 0.2, 0.5));
+    addBox(mesh, geo::Vec3(0.5, -3, -0.5), geo::Vec3(2.5, -2.8, 0.5));
+
+    geo::LaserRangeFinder lrf;
+    lrf.setNumBeams(1081);
+    lrf.setAngleLimits(-M_PI, M_PI);
+    lrf.setRangeLimits(0.05, 30);
+
+    std::vector<double> expected(lrf.getNumBeams(), 0);
+    geo::LaserRangeFinder::RenderOptions opt;
+    opt.setMesh(mesh, geo::Pose3D::identity());
+    geo::LaserRangeFinder::RenderResult res(expected);
+    lrf.render(opt, res);
+
+    sim::BeamCaster caster;
+    caster.configure(lrf.getAngleMin(), lrf.getAngleIncrement(), lrf.getNumBeams(), lrf.getRangeMin(),
+                     lrf.getRangeMax());
+
+    std::vector<float> ranges(caster.numBeams());
+    caster.cast(slice(mesh), &ranges[0]);
+
+    // Beams that just graze an edge of an obstacle may hit it in one and miss it in the other
+    int num_different = 0;
+    for(unsigned int i = 0; i < ranges.size(); ++i)
+    {
+        if (std::abs(ranges[i] - expected[i]) > 1e-3 * expected[i] + 1e-4)
+            ++num_different;
+    }
+
+    EXPECT_LE(num_different, 8);
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+int main(int argc, char **argv)
+{
+    testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
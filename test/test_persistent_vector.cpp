@@ -0,0 +1,74 @@
+#include "fast_simulator2/persistent_vector.h"
+
+#include <gtest/gtest.h>
+
+// ----------------------------------------------------------------------------------------------------
+
+// Enough elements for a tree of several levels
+const int N = 100000;
+
+// ----------------------------------------------------------------------------------------------------
+
+TEST(PersistentVector, PushBackAndIndex)
+{
+    sim::PersistentVector<int> v;
+    EXPECT_TRUE(v.empty());
+
+    for(int i = 0; i < N; ++i)
+        v.push_back(i);
+
+    ASSERT_EQ(N, (int)v.size());
+    for(int i = 0; i < N; ++i)
+        ASSERT_EQ(i, v[i]);
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+TEST(PersistentVector, CopiesAreIndependent)
+{
+    sim::PersistentVector<int> a;
+    for(int i = 0; i < N; ++i)
+        a.push_back(i);
+
+    sim::PersistentVector<int> b(a);
+    for(int i = 0; i < N; i += 7)
+        b.set(i, -i);
+    b.push_back(N);
+
+    // Changing the original does not change the copy either
+    a.set(1, 42);
+
+    ASSERT_EQ(N, (int)a.size());
+    ASSERT_EQ(N + 1, (int)b.size());
+    for(int i = 0; i < N; ++i)
+    {
+        ASSERT_EQ(i == 1 ? 42 : i, a[i]);
+        ASSERT_EQ(i % 7 == 0 ? -i : i, b[i]);
+    }
+    EXPECT_EQ(N, b[N]);
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+TEST(PersistentVector, IteratorVisitsAllInOrder)
+{
+    sim::PersistentVector<int> v;
+    for(int i = 0; i < N; ++i)
+        v.push_back(3 * i);
+
+    int n = 0;
+    for(sim::PersistentVector<int>::const_iterator it = v.begin(); it != v.end(); ++it, ++n)
+    {
+        ASSERT_EQ(n, (int)it.index());
+        ASSERT_EQ(3 * n, *it);
+    }
+    EXPECT_EQ(N, n);
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+int main(int argc, char **argv)
+{
+    testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
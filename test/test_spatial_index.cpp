@@ -0,0 +1,154 @@
+#include "fast_simulator2/spatial_index.h"
+
+#include <gtest/gtest.h>
+
+#include <cstdlib>
+
+// ----------------------------------------------------------------------------------------------------
+
+namespace
+{
+
+const int NUM_ENTITIES = 2000;
+
+double random(double max)
+{
+    return max * rand() / RAND_MAX;
+}
+
+// Mostly small boxes, and some that are large enough to span many cells (like floors and walls)
+sim::BoundingBox randomBox()
+{
+    geo::Vec3 c(random(50) - 25, random(50) - 25, random(4));
+    double s = rand() % 20 == 0 ? random(30) : random(1.5);
+    return sim::BoundingBox(c - geo::Vec3(s, s, 0.3 * s), c + geo::Vec3(s, s, 0.3 * s));
+}
+
+// Same random world as it is kept in the index, to compare the queries against brute force
+struct Boxes
+{
+    Boxes() : boxes(NUM_ENTITIES), valid(NUM_ENTITIES, false) {}
+    std::vector<sim::BoundingBox> boxes;
+    std::vector<bool> valid;
+};
+
+template<typename Query>
+std::vector<int> bruteForce(const Boxes& b, const Query& q)
+{
+    std::vector<int> indices;
+    for(int i = 0; i < NUM_ENTITIES; ++i)
+    {
+        if (b.valid[i] && q.intersects(b.boxes[i]))
+            indices.push_back(i);
+    }
+    return indices;
+}
+
+// Query by box, as the other volumes (box.intersects(other) instead of other.intersects(box))
+struct BoxQuery
+{
+    BoxQuery(const sim::BoundingBox& box_) : box(box_) {}
+    bool intersects(const sim::BoundingBox& other) const { return box.intersects(other); }
+    sim::BoundingBox box;
+};
+
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+TEST(SpatialIndex, QueriesMatchBruteForce)
+{
+    srand(0);
+
+    sim::SpatialIndex index;
+    Boxes boxes;
+
+    // Snapshots of the index during the updates, which must not be changed by later updates
+    std::vector<sim::SpatialIndex> snapshots;
+    std::vector<Boxes> snapshot_boxes;
+
+    for(int it = 0; it < 20000; ++it)
+    {
+        int i = rand() % NUM_ENTITIES;
+        if (rand() % 10 == 0)
+        {
+            index.remove(i);
+            boxes.valid[i] = false;
+        }
+        else
+        {
+            boxes.boxes[i] = randomBox();
+            boxes.valid[i] = true;
+            index.set(i, boxes.boxes[i]);
+        }
+
+        if (it % 2000 == 0)
+        {
+            snapshots.push_back(index);
+            snapshot_boxes.push_back(boxes);
+        }
+    }
+
+    snapshots.push_back(index);
+    snapshot_boxes.push_back(boxes);
+
+    for(unsigned int s = 0; s < snapshots.size(); ++s)
+    {
+        for(int q = 0; q < 50; ++q)
+        {
+            std::vector<int> indices;
+
+            sim::BoundingBox box = randomBox();
+            snapshots[s].query(box, indices);
+            ASSERT_EQ(bruteForce(snapshot_boxes[s], BoxQuery(box)), indices);
+
+            geo::Pose3D pose(geo::Matrix3::identity(), geo::Vec3(random(10), random(10), 1));
+
+            sim::Frustum frustum = sim::Frustum::camera(0.5, 0.5, 0.4, 0.4, 0.1, 5).transformed(pose);
+            snapshots[s].query(frustum, indices);
+            ASSERT_EQ(bruteForce(snapshot_boxes[s], frustum), indices);
+
+            sim::Sphere sphere(pose.t, random(5));
+            snapshots[s].query(sphere, indices);
+            ASSERT_EQ(bruteForce(snapshot_boxes[s], sphere), indices);
+
+            sim::Slab slab(pose.t, geo::Vec3(0, 0, 1), 0.01, random(10));
+            snapshots[s].query(slab, indices);
+            ASSERT_EQ(bruteForce(snapshot_boxes[s], slab), indices);
+        }
+    }
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+TEST(SpatialIndex, SetRemoveAndBounds)
+{
+    sim::SpatialIndex index;
+    sim::BoundingBox box(geo::Vec3(0, 0, 0), geo::Vec3(1, 1, 1));
+
+    index.set(3, box);
+    EXPECT_EQ(1u, index.size());
+
+    sim::BoundingBox b;
+    ASSERT_TRUE(index.bounds(3, b));
+    EXPECT_EQ(1, b.max.x);
+    EXPECT_FALSE(index.bounds(4, b));
+
+    // Moving the entity far away
+    index.set(3, sim::BoundingBox(geo::Vec3(100, 100, 0), geo::Vec3(101, 101, 1)));
+    std::vector<int> indices;
+    index.query(box, indices);
+    EXPECT_TRUE(indices.empty());
+
+    index.remove(3);
+    EXPECT_EQ(0u, index.size());
+    EXPECT_FALSE(index.bounds(3, b));
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+int main(int argc, char **argv)
+{
+    testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
@@ -0,0 +1,86 @@
+#include "fast_simulator2/thread_pool.h"
+
+#include <boost/atomic.hpp>
+#include <boost/bind.hpp>
+
+#include <gtest/gtest.h>
+
+// ----------------------------------------------------------------------------------------------------
+
+namespace
+{
+
+void increment(boost::atomic<int>* counter)
+{
+    ++*counter;
+}
+
+// Runs a nested group from within a task, which must not deadlock: the waiting task helps
+void runNested(sim::ThreadPool* pool, boost::atomic<int>* counter)
+{
+    sim::TaskGroup group(*pool);
+    for(int i = 0; i < 50; ++i)
+        group.run(boost::bind(&increment, counter));
+    group.wait();
+}
+
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+TEST(ThreadPool, GroupRunsAllTasks)
+{
+    sim::ThreadPool pool(4);
+    boost::atomic<int> counter(0);
+
+    sim::TaskGroup group(pool);
+    for(int i = 0; i < 1000; ++i)
+        group.run(boost::bind(&increment, &counter));
+    group.wait();
+
+    EXPECT_TRUE(group.finished());
+    EXPECT_EQ(1000, counter);
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+TEST(ThreadPool, NestedGroups)
+{
+    sim::ThreadPool pool(4);
+    boost::atomic<int> counter(0);
+
+    for(int k = 0; k < 20; ++k)
+    {
+        sim::TaskGroup group(pool);
+        for(int i = 0; i < 40; ++i)
+            group.run(boost::bind(&runNested, &pool, &counter));
+        group.wait();
+    }
+
+    EXPECT_EQ(20 * 40 * 50, counter);
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+TEST(ThreadPool, GroupIsReusable)
+{
+    sim::ThreadPool pool(2);
+    boost::atomic<int> counter(0);
+
+    sim::TaskGroup group(pool);
+    for(int k = 0; k < 100; ++k)
+    {
+        group.run(boost::bind(&increment, &counter));
+        group.run(boost::bind(&increment, &counter));
+        group.wait();
+        ASSERT_EQ(2 * (k + 1), counter);
+    }
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+int main(int argc, char **argv)
+{
+    testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
@@ -0,0 +1,159 @@
+#include "fast_simulator2/world.h"
+
+#include <ed/update_request.h>
+#include <ed/entity.h>
+#include <ed/relation.h>
+
+#include <boost/lexical_cast.hpp>
+
+#include <gtest/gtest.h>
+
+// ----------------------------------------------------------------------------------------------------
+
+namespace
+{
+
+std::string entityId(int i)
+{
+    return "entity_" + boost::lexical_cast<std::string>(i);
+}
+
+// Fixed translation along x
+class TranslationRelation : public ed::Relation
+{
+
+public:
+
+    TranslationRelation(double x) : x_(x) {}
+
+    ed::Time latestTime() const { return ed::Time(); }
+
+    bool calculateTransform(const ed::Time& t, geo::Pose3D& tf) const
+    {
+        tf = geo::Pose3D(geo::Matrix3::identity(), geo::Vector3(x_, 0, 0));
+        return true;
+    }
+
+private:
+
+    double x_;
+
+};
+
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+TEST(World, UpdateSharesUnchangedEntities)
+{
+    const int N = 1000;
+
+    sim::World w1;
+    ed::UpdateRequest req;
+    for(int i = 0; i < N; ++i)
+        req.setType(entityId(i), "object");
+    req.setPose(entityId(5), geo::Pose3D::identity());
+    w1.update(req);
+    ASSERT_EQ(N, (int)w1.numEntities());
+
+    sim::World w2(w1);
+    ed::UpdateRequest req2;
+    req2.setPose(entityId(5), geo::Pose3D(geo::Matrix3::identity(), geo::Vector3(1, 2, 3)));
+    req2.removeEntity(entityId(7));
+    w2.update(req2);
+
+    // Only the changed entity is cloned; the other entities are shared by both snapshots
+    for(int i = 0; i < N; ++i)
+    {
+        ed::EntityConstPtr e1 = w1.getEntity(entityId(i));
+        ed::EntityConstPtr e2 = w2.getEntity(entityId(i));
+        ASSERT_TRUE(e1);
+
+        if (i == 5)
+            EXPECT_NE(e1.get(), e2.get());
+        else if (i == 7)
+            EXPECT_FALSE(e2);
+        else
+            EXPECT_EQ(e1.get(), e2.get());
+    }
+
+    // The old snapshot is not changed
+    EXPECT_EQ(N, (int)w1.numEntities());
+    EXPECT_EQ(N - 1, (int)w2.numEntities());
+    EXPECT_EQ(0, w1.getEntity(entityId(5))->pose().t.x);
+    EXPECT_EQ(2, w2.getEntity(entityId(5))->pose().t.y);
+    EXPECT_GT(w2.revision(), w1.revision());
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+TEST(World, RemovedEntityGetsNewIndex)
+{
+    sim::World w1;
+    ed::UpdateRequest req;
+    req.setType("a", "object");
+    w1.update(req);
+
+    sim::LUId id("a");
+    int idx1;
+    ASSERT_TRUE(w1.findEntityIdx(id, idx1));
+
+    sim::World w2(w1);
+    ed::UpdateRequest req_remove;
+    req_remove.removeEntity("a");
+    w2.update(req_remove);
+    EXPECT_FALSE(w2.getEntity(id));
+
+    w2.update(req);
+    int idx2;
+    ASSERT_TRUE(w2.findEntityIdx(id, idx2));
+    EXPECT_NE(idx1, idx2);
+
+    // The LUId and string lookups agree, in both snapshots
+    int idx;
+    ASSERT_TRUE(w1.findEntityIdx(std::string("a"), idx));
+    EXPECT_EQ(idx1, idx);
+    ASSERT_TRUE(w2.findEntityIdx(std::string("a"), idx));
+    EXPECT_EQ(idx2, idx);
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+TEST(World, WorldPoses)
+{
+    sim::World w;
+    ed::UpdateRequest req;
+    req.setType("world", "root");
+    req.setType("a", "object");
+    req.setType("b", "object");
+    req.setType("lone", "object");
+    req.setRelation("world", "a", ed::RelationConstPtr(new TranslationRelation(1)));
+    req.setRelation("a", "b", ed::RelationConstPtr(new TranslationRelation(2)));
+    w.update(req);
+
+    // Walking the tree (no poses prepared) and the prepared poses give the same results
+    for(int prepared = 0; prepared < 2; ++prepared)
+    {
+        if (prepared)
+            w.preparePoses(0);
+
+        geo::Pose3D pose;
+        ASSERT_TRUE(w.worldPose(sim::LUId("b"), 0, pose));
+        EXPECT_DOUBLE_EQ(3, pose.t.x);
+
+        EXPECT_FALSE(w.worldPose(sim::LUId("lone"), 0, pose));
+        EXPECT_FALSE(w.worldPose(sim::LUId("unknown"), 0, pose));
+
+        ASSERT_TRUE(w.calculateTransform("a", "b", 0, pose));
+        EXPECT_DOUBLE_EQ(2, pose.t.x);
+        EXPECT_FALSE(w.calculateTransform("a", "lone", 0, pose));
+    }
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+int main(int argc, char **argv)
+{
+    testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}